@@ -21,13 +21,49 @@
  *     -0         NULL (0 byte) characters included
  *     -a         all ASCII character (default)
  *     -d delay   Delay for "delay" seconds between characters
- *     -o file    Record characters in "file"
- *     -r file    Replay characters in "file"
+ *     -c rate    send "rate" characters per second
+ *     -B burst   with -d or -c, send "burst" characters between waits
+ *     -v         report statistics of the run on stderr (bytes, lines,
+ *                time generating and writing, write calls, histograms),
+ *                and the rate achieved with -d or -c
+ *     -J file    write the same statistics to "file" as JSON
+ *     -O file    record the seed and options (not the characters) in "file"
+ *     -R file    regenerate the characters recorded with -O in "file"
+ *     -o file    Record characters in "file", in the background: the
+ *                record is complete at exit, also after SIGPIPE
+ *     -f sync    with -o, fdatasync() the record "end" (when done) or
+ *                every "sync" bytes and when done
+ *     -q name    send the characters to "ptyjig -q name" through the
+ *                shared memory ring "name" instead of stdout
+ *     -r file    Replay characters in "file", or case(s) "pack:id[-id]"
+ *                of a pack made by fuzzpack
  *     -l         random length LF terminated strings (lll max. default 255)
  *     -p         printable ASCII only
  *     -s         use sss as random seed
  *     -e         send "epilog" after all random characters
+ *     -b prolog  send "prolog" before them
+ *     -L         with -l, send "prolog" and "epilog" around every line
  *     -x         print the random seed as the first line
+ *     -g gen     random generator: "xoshiro" (default), "philox" (counter
+ *                based, fast -S) or "rand" (libc, as in earlier versions)
+ *     -m file    output a mutant of "file" made from the seed, -N of them
+ *                for many; the -O record keeps the mutations
+ *     -w spec    draw bytes with weights, "item=weight,...": items are
+ *                byte numbers, ranges n-m, ^X, nul, esc, del, lf, cr, tab,
+ *                ctype classes (print, cntrl, ...), high and all
+ *     -D file    mix in tokens of the dictionary "file", one per line,
+ *                "[weight] "token"" with C escapes; NUM then counts
+ *                tokens as one character each, and -m inserts them
+ *     -i prob    with -D, about "prob" of the characters are tokens
+ *                (default 0.05)
+ *     -j num     generate with num threads; the output does not change
+ *     -S off,len only output bytes (lines with -l) off to off + len - 1
+ *     -N count   make "count" test cases, each from its own seed
+ *     -T target  where -N puts the cases: "stream" (default, each case
+ *                preceded by its length and a LF on stdout),
+ *                "dir:path" (files path/0, path/1, ...) or "pack:path"
+ *     -M file    with -N, write the -O record of each case to "file"
+ *     -F         with -N, preallocate case files with fallocate()
  *
  *  Defaults:
  *     fuzz -a 
@@ -44,47 +80,198 @@
 
 static char *progname = "fuzz";
 
+#define _GNU_SOURCE             /* splice(), copy_file_range() */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
 #include <strings.h>
 #include <time.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "pace.h"
+#include "pack.h"
+#include "fuzzgen.h"
+#include "mutate.h"
+#include "stats.h"
+#include "tee.h"
+#include "ring.h"
 
 #define SWITCH '-'
 
+#define OBUFSIZ   (1 << 20)     /* Size of the output buffer */
+#define OBUFALIGN 4096          /* ... and its alignment */
+#define MAPPIECE  (64 << 20)    /* Bytes of a mapping written at once */
+
 #define TRUE  1
 #define FALSE 0
 
+#define GEN_RAND    0           /* libc rand(), replays old seeds */
+#define GEN_XOSHIRO FUZZGEN_XOSHIRO
+#define GEN_PHILOX  FUZZGEN_PHILOX
+
+/*
+ * Version of the generated streams, kept in -O records.  Bump it
+ * whenever a seed and options no longer give the same stream.
+ */
+#define STREAMVERSION 1
+
+#define RECMAX 16384            /* Longest -O record line */
+
+#define MUTSALT 0x6d7574616e74ULL /* Seed of -m mutations is seed ^ this */
+
+#define TGT_STREAM 0            /* -T targets of -N */
+#define TGT_DIR    1
+#define TGT_PACK   2
+
+#define SLOT_FREE  0            /* States of a chunk slot in fuzzthreads() */
+#define SLOT_BUSY  1
+#define SLOT_READY 2
+
+/* A chunk buffer shared between the threads of fuzzthreads() */
+struct slot {
+  char      *buf;
+  int        len;
+  long long  k;
+  int        state;
+};
+
 
 /* Function Prototypes */
 void usage();
 void init();
 void replay();
+void putrecord(FILE *f);
+int  getrecord(char *line);
+void setweights();
+void loaddict();
+int  unescape(char *s, int q, char *buf, char **end);
+int  randtoken();
+long randwide();
+void putmutant();
+int  byteclass(char *item, int *lo, int *hi, int (**is)(int));
+void seedstream();
+void batch();
+void putcase(long long i);
+long long caseseed(long long base, long long i);
+void capture(char *p, int n);
+off_t zerocopy(int fd, off_t size);
+int   openpacked();
+void  replaypack();
 void fuzz();
 void putch(int i);
 void fuzzchar(int m, int h);
 void fuzzstr(int m, int h);
-void myputs(char *s);
-int  oct2dec(int i);
+void putbytes(char *p, int n);
+void putesc(FILE *f, char *p, int n);
+void abspath(char *path);
+int  getpath(char *s, char *path);
+void out_write(char *p, int n);
+void out_flush();
+int  sendout(struct iovec *iov, int cnt);
+void outfail();
+void recordend();
+int  writev_all(int fd, struct iovec *iov, int cnt);
+int      genchunk(struct fuzzgen_rng *r, long long k, char *buf);
+void     fuzzchunks();
+void     fuzzthreads();
+void    *worker(void *arg);
+char    *chunkalloc();
 
 /* Global flags */
 int      flag0  = FALSE;
 int      flaga  = TRUE;		/* FALSE if flagp */
-unsigned flagd  = FALSE;
+double   flagd  = FALSE;        /* Delay between characters in seconds */
+double   flagc  = FALSE;        /* ... or characters per second */
+long     flagB  = 1;            /* Characters between waits */
+int      flagv  = FALSE;
+char    *flagJ;                 /* JSON statistics file */
+int      counting = FALSE;      /* -v or -J: keep "counts" */
+struct stats counts;
 int      flagl  = FALSE;
 int      flags  = FALSE;
 int      flage  = FALSE;
-int      seed   = FALSE;
+long long seed  = FALSE;
 int      flagn  = FALSE;
 int      flagx  = FALSE;
 int      flago  = FALSE;
 int      flagr  = FALSE;
-int      length = FALSE;
-char     epilog[1024];
+long long length = FALSE;
+int      nthreads = 1;
+int      flagS  = FALSE;
+long long rfrom, rlen;          /* Range given with -S ... */
+long long rto;                  /* ... and its end, within "length" */
+char     epilog[RECMAX];        /* -e as given ... */
+char     epi[RECMAX];           /* ... and compiled once, "elen" bytes */
+int      elen;
+int      flagb  = FALSE;
+char     prolog[RECMAX], pro[RECMAX]; /* Same for -b */
+int      plen;
+int      flagL  = FALSE;        /* -b and -e go around each line */
 char    *infile, *outfile;
-FILE    *in, *out;
+FILE    *in;
+struct tee otee;                /* -o record, and ... */
+long long flagf = TEE_SYNC_NONE; /* ... how it is synced */
+char    *flagq;                 /* Ring that takes the place of stdout */
+struct ring ring;
+int      flagO  = FALSE;
+int      flagR  = FALSE;
+char    *recfile;
+int      flagw  = FALSE;
+char     wspec[RECMAX];         /* -w as given ... */
+double   weights[256];          /* ... and the weights it makes */
+int      flagm  = FALSE;
+char     mpath[RECMAX];         /* File to mutate ... */
+char     mops[MUT_OPSMAX];      /* ... with these mutations, from -R */
+int      flagops = FALSE;
+struct mutant mut;
+struct fuzzgen *mg;             /* Draws the mutations */
+int      flagD  = FALSE;
+char     dpath[RECMAX];         /* Dictionary file ... */
+double   flagi  = 0.05;         /* ... its tokens mixed in as this fraction */
+struct fuzzgen_dict dict;
+long long dgap, dgapmax;        /* Gaps between tokens with -g rand */
+int      lendrawn = FALSE;      /* "length" came from the generator */
+int      packed = FALSE;        /* -r names cases in a pack ... */
+struct pack rpack;              /* ... which is this one */
+uint64_t pfrom, pto;
+long long flagN = FALSE;        /* Number of cases to make, 0 for one stream */
+int      flagF  = FALSE;
+int      target = TGT_STREAM;
+char    *tpath, *manfile;       /* Path of the -T target, -M manifest */
+FILE    *man;
+struct pack tpack;              /* -T pack:path */
+
+/* Output stage: everything sent to stdout is collected in "obuf" */
+char    *obuf;
+int      olen   = 0;
+int      capturing = FALSE;     /* With -N, output goes to "cbuf" instead */
+char    *cbuf;
+size_t   clen, csize;
+int      paced  = FALSE;        /* -d or -c given */
+struct pace pace;
+
+/*
+ * Random generator.  Except with -g rand, the stream comes from
+ * libfuzzgen, in chunks that can be made in any order and by any
+ * number of threads and still give the same output.
+ */
+int      gen    = GEN_XOSHIRO;
+struct fuzzgen *fg;
 
 
 /*
@@ -93,12 +280,14 @@ FILE    *in, *out;
  */
 int main(int argc, char **argv) {
   float f;
+  char *s;
+  FILE *jf;
 
 
   /* Parse command line */
   while( *(++argv) != NULL ) {
     if (**argv != SWITCH) {	/* Not a switch, must be a length */
-      if( sscanf(*argv, "%d", &length) != 1 ) {
+      if( sscanf(*argv, "%lld", &length) != 1 ) {
          usage();
       }
 
@@ -121,7 +310,55 @@ int main(int argc, char **argv) {
             usage();
           }
 
-          flagd = (unsigned) (f * 1000000.0);
+          flagd = f;
+          break;
+
+        case 'c':
+          argv++;
+
+          if( *argv == NULL || sscanf(*argv, "%lf", &flagc) != 1 ||
+              flagc < 0 ) {
+            usage();
+          }
+          break;
+
+        case 'B':
+          argv++;
+
+          if( *argv == NULL || sscanf(*argv, "%ld", &flagB) != 1 ||
+              flagB <= 0 ) {
+            usage();
+          }
+          break;
+
+        case 'v':
+          flagv = TRUE;
+          break;
+
+        case 'J':
+          argv++;
+          flagJ = *argv;
+
+          if( flagJ == NULL ) {
+            usage();
+          }
+          break;
+
+        case 'O':
+        case 'R':
+          if( (*argv)[1] == 'O' ) {
+            flagO = TRUE;
+          }
+          else {
+            flagR = TRUE;
+          }
+
+          argv++;
+          recfile = *argv;
+
+          if( recfile == NULL ) {
+            usage();
+          }
           break;
 
         case 'o':
@@ -130,6 +367,27 @@ int main(int argc, char **argv) {
           outfile = *argv;
           break;
 
+        case 'q':
+          argv++;
+          flagq = *argv;
+
+          if( flagq == NULL ) {
+            usage();
+          }
+          break;
+
+        case 'f':
+          argv++;
+
+          if( *argv != NULL && strcmp(*argv, "end") == 0 ) {
+            flagf = TEE_SYNC_END;
+          }
+          else if( *argv == NULL || sscanf(*argv, "%lld", &flagf) != 1 ||
+                   flagf <= 0 ) {
+            usage();
+          }
+          break;
+
         case 'r':
           flagr = TRUE;
           argv++;
@@ -156,51 +414,250 @@ int main(int argc, char **argv) {
           argv++;
           flags = TRUE;
 
-          if( sscanf(*argv, "%d", &seed) != 1 ) {
+          if( *argv == NULL || sscanf(*argv, "%lld", &seed) != 1 ) {
             usage();
           }
           break;
 
         case 'e':
+        case 'b':
+          if( (*argv)[1] == 'e' ) {
+            flage = TRUE;
+            s     = epilog;
+          }
+          else {
+            flagb = TRUE;
+            s     = prolog;
+          }
+
           argv++;
-          flage = TRUE;
- 
-          if( *argv == NULL ) {
+
+          if( *argv == NULL || strlen(*argv) >= sizeof(epilog) ) {
             usage();
           }
 
-          sprintf(epilog, "%s", *argv);
+          strcpy(s, *argv);
+          break;
+
+        case 'L':
+          flagL = TRUE;
           break;
 
         case 'x':
           flagx = TRUE;
           break;
 
+        case 'g':
+          argv++;
+
+          if( *argv == NULL ) {
+            usage();
+          }
+
+          if( strcmp(*argv, "rand") == 0 ) {
+            gen = GEN_RAND;
+          }
+          else if( strcmp(*argv, "xoshiro") == 0 ) {
+            gen = GEN_XOSHIRO;
+          }
+          else if( strcmp(*argv, "philox") == 0 ) {
+            gen = GEN_PHILOX;
+          }
+          else {
+            usage();
+          }
+          break;
+
+        case 'm':
+          argv++;
+          flagm = TRUE;
+
+          if( *argv == NULL || strlen(*argv) >= sizeof(mpath) ) {
+            usage();
+          }
+
+          strcpy(mpath, *argv);
+          break;
+
+        case 'w':
+          argv++;
+          flagw = TRUE;
+
+          if( *argv == NULL || strlen(*argv) >= sizeof(wspec) ) {
+            usage();
+          }
+
+          strcpy(wspec, *argv);
+          break;
+
+        case 'D':
+          argv++;
+          flagD = TRUE;
+
+          if( *argv == NULL || strlen(*argv) >= sizeof(dpath) ) {
+            usage();
+          }
+
+          strcpy(dpath, *argv);
+          break;
+
+        case 'i':
+          argv++;
+
+          if( *argv == NULL || sscanf(*argv, "%lf", &flagi) != 1 ||
+              !(flagi >= 1e-6 && flagi <= 1) ) {
+            usage();
+          }
+          break;
+
+        case 'j':
+          argv++;
+
+          if( *argv == NULL || sscanf(*argv, "%d", &nthreads) != 1 ||
+              nthreads <= 0 ) {
+            usage();
+          }
+          break;
+
+        case 'S':
+          argv++;
+          flagS = TRUE;
+
+          if( *argv == NULL ||
+              sscanf(*argv, "%lld,%lld", &rfrom, &rlen) != 2 ||
+              rfrom < 0 || rlen < 0 ) {
+            usage();
+          }
+          break;
+
+        case 'N':
+          argv++;
+
+          if( *argv == NULL || sscanf(*argv, "%lld", &flagN) != 1 ||
+              flagN <= 0 ) {
+            usage();
+          }
+          break;
+
+        case 'T':
+          argv++;
+
+          if( *argv == NULL ) {
+            usage();
+          }
+
+          if( strcmp(*argv, "stream") == 0 ) {
+            target = TGT_STREAM;
+          }
+          else if( strncmp(*argv, "dir:", 4) == 0 && (*argv)[4] != 0 ) {
+            target = TGT_DIR;
+            tpath  = *argv + 4;
+          }
+          else if( strncmp(*argv, "pack:", 5) == 0 && (*argv)[5] != 0 ) {
+            target = TGT_PACK;
+            tpath  = *argv + 5;
+          }
+          else {
+            usage();
+          }
+          break;
+
+        case 'M':
+          argv++;
+          manfile = *argv;
+
+          if( manfile == NULL ) {
+            usage();
+          }
+          break;
+
+        case 'F':
+          flagF = TRUE;
+          break;
+
         default:
           usage();
       }
     }
   }
 
+  /* -O and -R only make sense for generated streams */
+  if( ((flagO || flagR) && flagr) || (flagO && flagR) ) {
+    usage();
+  }
+
+  /* Cases are made whole, from seeds of their own, and not paced */
+  if( flagN && (flagr || flagO || flagR || flagd > 0 || flagc > 0) ) {
+    usage();
+  }
+
+  if( flagm && (flagr || flagS) ) {
+    usage();
+  }
+
+  /* Around lines of fresh characters only */
+  if( flagL && (!flagl || flagr || flagm) ) {
+    usage();
+  }
+
   init();
 
-  if( flagr ) {
-    replay();
+  if( flagN ) {
+    batch();
   }
   else {
-    fuzz();
+    if( !flagL ) {
+      putbytes( pro, plen );
+    }
+
+    if( flagr ) {
+      replay();
+    }
+    else {
+      fuzz();
+    }
+
+    if( !flagL ) {
+      putbytes( epi, elen );
+    }
   }
 
-  myputs( epilog );
+  out_flush();
 
-  if( flago ) {
-    if( fclose(out) == EOF ) {
-      perror(outfile);
+  if( flagq != NULL ) {
+    ring_close( &ring );
+  }
+
+  counts.sleeps = pace.sleeps;
+
+  if( flagv ) {
+    pace_report( &pace, stderr, progname );
+    stats_report( &counts, stderr, progname );
+  }
+
+  if( flagJ != NULL ) {
+    if( (jf = fopen(flagJ, "w")) == NULL ) {
+      perror(flagJ);
+      exit(1);
+    }
+
+    stats_json( &counts, jf );
+
+    if( fclose(jf) == EOF ) {
+      perror(flagJ);
       exit(1);
     }
   }
 
-  if( flagr ) {
+  if( flago && tee_close(&otee) < 0 ) {
+    perror(outfile);
+    exit(1);
+  }
+
+  if( packed ) {
+    pack_close( &rpack );
+  }
+  else if( flagr ) {
     if( fclose(in) == EOF ) {
       perror(infile);
       exit(1);
@@ -223,13 +680,47 @@ void usage() {
   printf("     -0         include NULL (0 byte) character in output\n"); 
   printf("     -a         use all ASCII characters in output (default)\n"); 
   printf("     -d DELAY   delay for DELAY seconds between characters\n"); 
-  printf("     -o FILE    record characters in FILE\n"); 
-  printf("     -r FILE    replay characters in FILE\n"); 
+  printf("     -c RATE    send RATE characters per second\n"); 
+  printf("     -B BURST   with -d or -c, send BURST characters between waits\n"); 
+  printf("     -v         report statistics of the run on stderr (bytes, lines,\n"); 
+  printf("                time generating and writing, write calls, histograms)\n"); 
+  printf("                and the rate achieved with -d or -c\n"); 
+  printf("     -J FILE    write the same statistics to FILE as JSON\n"); 
+  printf("     -O FILE    record the seed and options (not the characters) in FILE\n"); 
+  printf("     -R FILE    regenerate the characters recorded with -O in FILE\n"); 
+  printf("     -o FILE    record characters in FILE (written in the background)\n"); 
+  printf("     -f SYNC    with -o, sync FILE at the \"end\" or every SYNC bytes\n"); 
+  printf("     -q NAME    send the characters to \"ptyjig -q NAME\" through a\n"); 
+  printf("                shared memory ring instead of stdout\n"); 
+  printf("     -r FILE    replay characters in FILE, or the cases PACK:ID or\n"); 
+  printf("                PACK:FROM-TO of a pack made by fuzzpack\n"); 
   printf("     -l         use random length LF terminated strings (lll max. default 255) \n"); 
   printf("     -p         use only printable ASCII character in output\n"); 
   printf("     -s SEED    force random seed to be SEED\n"); 
   printf("     -e EPILOG  finish random output stream with characters given by EPILOG\n"); 
-  printf("     -x         print the random seed as the first line \n\n"); 
+  printf("     -b PROLOG  start it with the characters given by PROLOG\n"); 
+  printf("     -L         with -l, put PROLOG and EPILOG around every line\n"); 
+  printf("     -x         print the random seed as the first line \n"); 
+  printf("     -g GEN     random generator, \"xoshiro\" (default), \"philox\" (counter\n");
+  printf("                based, fast -S) or \"rand\" (libc, replays seeds of\n");
+  printf("                earlier versions of fuzz)\n"); 
+  printf("     -m FILE    output a mutant of FILE made from the seed (-N for many)\n");
+  printf("     -w SPEC    draw bytes with weights, SPEC is ITEM=WEIGHT,...; items\n");
+  printf("                are byte numbers, ranges N-M, ^X, nul, esc, del, lf, cr,\n");
+  printf("                tab, ctype classes (print, cntrl, ...), high and all\n");
+  printf("     -D FILE    mix in the tokens of dictionary FILE, one per line as\n");
+  printf("                [WEIGHT] \"TOKEN\" with C escapes; NUM counts a token\n");
+  printf("                as one character, and -m inserts tokens from FILE\n");
+  printf("     -i PROB    with -D, make about PROB of the characters tokens\n");
+  printf("                (default 0.05)\n");
+  printf("     -j NUM     generate with NUM threads (same output for any NUM)\n"); 
+  printf("     -S OFF,LEN only output bytes (lines with -l) OFF to OFF+LEN-1\n"); 
+  printf("     -N COUNT   make COUNT test cases, each from its own seed\n"); 
+  printf("     -T TARGET  where -N puts the cases: \"stream\" (default, each case\n"); 
+  printf("                after its length and a LF on stdout), \"dir:PATH\"\n"); 
+  printf("                (files PATH/0, PATH/1, ...) or \"pack:PATH\"\n"); 
+  printf("     -M FILE    with -N, write the -O record of each case to FILE\n"); 
+  printf("     -F         with -N, preallocate case files with fallocate()\n\n"); 
   printf("  Defaults: \n"); 
   printf("     fuzz -a\n\n"); 
   printf("  Authors: \n"); 
@@ -246,47 +737,163 @@ void usage() {
  */
 void init() {
   long now;
+  char line[RECMAX], *s;
+  FILE *f;
+  int  fd, n;
+  char *force = getenv("FUZZ_KERNEL");
+
+
+  if( force != NULL && fuzzgen_kernel(force) < 0 ) {
+    fprintf(stderr, "%s: kernel %s not available\n", progname, force);
+    exit(1);
+  }
+
+  /* Pacing */
+  if( flagc == 0 && flagd > 0 ) {
+    flagc = 1.0 / flagd;
+  }
+
+  if( flagB > OBUFSIZ ) {
+    flagB = OBUFSIZ;
+  }
 
+  pace_init( &pace, flagc, flagB );
+  paced = flagc > 0;
 
-  /* Init random numbers */
+  /* Statistics, counted as the output leaves */
+  counting = flagv || flagJ != NULL;
+  stats_init( &counts );
+  counts.reading = flagr;
+
+  /* Aligned output buffer, flushed with writev() */
+  if( posix_memalign((void **)&obuf, OBUFALIGN, OBUFSIZ) != 0 ) {
+    perror(progname);
+    exit(1);
+  }
+
+  /* Stream recorded with -O */
+  if( flagR ) {
+    if( (f = fopen(recfile, "r")) == NULL ) {
+      perror(recfile);
+      exit(1);
+    }
+
+    if( fgets(line, sizeof(line), f) == NULL || getrecord(line) < 0 ) {
+      fprintf(stderr, "%s: %s: not a fuzz record\n", progname, recfile);
+      exit(1);
+    }
+
+    (void) fclose(f);
+  }
+
+  if( flagw ) {
+    setweights();
+  }
+
+  if( flagD ) {
+    loaddict();
+  }
+
+  /* Prologue and epilog are made once, and copied out as they are */
+  plen = unescape( prolog, 0, pro, &s );
+  elen = unescape( epilog, 0, epi, &s );
+
+  /* A mutant has the length the mutations give it */
+  if( flagm ) {
+    if( gen == GEN_RAND ) {
+      fprintf(stderr, "%s: -m needs -g xoshiro or philox\n", progname);
+      exit(1);
+    }
+
+    if( mut_open(&mut, mpath) < 0 ) {
+      perror(mpath);
+      exit(1);
+    }
+
+    abspath( mpath );
+
+    flagn = TRUE;
+  }
+
+  /* Init random numbers: 64 bits from the kernel, else from the time */
   if( !flags ) {
-    seed = (int)(time(&now) % 37);
+    if( (f = fopen("/dev/urandom", "rb")) == NULL ||
+        fread(&seed, sizeof(seed), 1, f) != 1 ) {
+      seed = (long long) time(&now) * 0x9e3779b97f4a7c15LL ^ getpid();
+    }
+
+    if( f != NULL ) {
+      (void) fclose(f);
+    }
+
+    flags = TRUE;
   }
 
-  srand(seed);
+  seedstream();
 
-  /* Random length if necessary */
-  if( !flagn ) {
-    length = rand() % 100000;
+  /* Everything that makes the stream is known: record it */
+  if( flagO ) {
+    if( (f = fopen(recfile, "w")) == NULL ) {
+      perror(recfile);
+      exit(1);
+    }
+
+    putrecord(f);
+
+    if( fclose(f) == EOF ) {
+      perror(recfile);
+      exit(1);
+    }
   }
 
   /* Open data files if necessary */
+  /*
+   * The record is written by a thread of its own.  SIGPIPE is held
+   * off, so that when the reader of stdout goes away the record can
+   * still be completed before fuzz dies of it (see outfail()).
+   */
   if( flago ) {
-    if ((out = fopen(outfile, "wb")) == NULL) {
+    if( (fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0 ||
+        tee_open(&otee, fd, flagf) < 0 ) {
       perror(outfile);
       exit(1);
     }
+
+    signal( SIGPIPE, SIG_IGN );
+    atexit( recordend );
+  }
+
+  if( flagq != NULL && ring_create(&ring, flagq) < 0 ) {
+    perror(flagq);
+    exit(1);
   }
 
   if( flagr ) {
     if( (in = fopen(infile, "rb")) == NULL ) {
-      perror(infile);
-      exit(1);
+      if( errno != ENOENT || openpacked() < 0 ) {
+        perror(infile);
+        exit(1);
+      }
     }
   } 
-  else if( flagx ) {
-    printf("%d\n", seed);
+  else if( flagx && !flagN ) {
+    n = sprintf(line, "%lld\n", seed);
 
-    if( fflush(stdout) == EOF ) {
-      perror(progname);
+    if( flago && tee_write(&otee, line, n) < 0 ) {
+      perror(outfile);
       exit(1);
     }
 
-    if( flago ) {
-      fprintf(out, "%d\n", seed);
+    if( flagq != NULL ) {
+      if( ring_write(&ring, line, n) < 0 ) {
+        outfail();
+      }
+    }
+    else {
+      printf("%s", line);
 
-      if( fflush(out) == EOF ) {
-        perror(outfile);
+      if( fflush(stdout) == EOF ) {
+        perror(progname);
         exit(1);
       }
     }
@@ -295,20 +902,1010 @@ void init() {
 
 
 /*
- * Replay characters in "in" 
+ * Seed the generator with "seed", draw the length if none was given
+ * and work out the part of the stream to output
  */
-void replay() {
-  int c;
+void seedstream() {
+  struct fuzzgen_opts o;
 
 
-  while(  (c = getc(in)) != EOF  ) {
-    putch(c);
+  if( gen == GEN_RAND ) {
+    srand((unsigned) seed);
   }
-}
+  else {
+    o.gen     = gen;
+    o.nul     = flag0;
+    o.all     = flaga;
+    o.lines   = flagm ? 0 : flagl;  /* Mutants insert bytes */
+    o.weights = flagw ? weights : NULL;
+    o.dict    = flagD && !flagm ? &dict : NULL;
+    o.dictp   = flagi;
+    o.head    = pro;
+    o.headlen = flagL ? plen : 0;
+    o.tail    = epi;
+    o.taillen = flagL ? elen : 0;
+
+    fuzzgen_free( fg );
+
+    if( (fg = fuzzgen_init(&o, (uint64_t) seed)) == NULL ) {
+      if( errno == EOVERFLOW ) {
+        fprintf(stderr, "%s: lines of %d units of up to %d bytes are too long\n",
+                progname, flagl, flagD ? dict.maxlen : 1);
+        exit(1);
+      }
 
+      perror(progname);
+      exit(1);
+    }
+  }
 
-/*
- * Decide the effective range of the random characters 
+  dgap = -1;
+
+  /* The mutations are drawn, or given by a record */
+  if( flagm ) {
+    mut_reset( &mut );
+    mut.dict = flagD ? &dict : NULL;
+
+    if( flagops ) {
+      if( mut_apply(&mut, mops, fg) < 0 ) {
+        fprintf(stderr, "%s: %s: mutations do not fit\n", progname, mpath);
+        exit(1);
+      }
+    }
+    else {
+      o.all     = TRUE;
+      o.nul     = TRUE;
+      o.weights = NULL;
+      o.dict    = NULL;
+      fuzzgen_free( mg );
+
+      if( (mg = fuzzgen_init(&o, (uint64_t) seed ^ MUTSALT)) == NULL ||
+          mut_random(&mut, mg, fg, flagl) < 0 ) {
+        perror(mpath);
+        exit(1);
+      }
+    }
+
+    length = mut.len;
+  }
+
+  /* Random length if necessary */
+  if( !flagn ) {
+    length = gen == GEN_RAND ? rand() % 100000 : fuzzgen_drawlength(fg, 100000);
+    flagn  = lendrawn = TRUE;
+  }
+
+  /* Part of the stream to output */
+  if( !flagS ) {
+    rfrom = 0;
+    rlen  = length;
+  }
+
+  rto = rfrom + rlen < length ? rfrom + rlen : length;
+}
+
+
+/*
+ * Make "flagN" test cases in one run.  Case i is the stream of the
+ * seed caseseed(seed, i) with the other options as given, so that
+ * its line of the manifest regenerates it with -R.  Each case is
+ * collected whole in "cbuf" and then written out to the target in
+ * one go.
+ */
+void batch() {
+  long long base = seed, i;
+  int       drawn = lendrawn;
+
+
+  if( manfile != NULL && (man = fopen(manfile, "w")) == NULL ) {
+    perror(manfile);
+    exit(1);
+  }
+
+  if( target == TGT_DIR && mkdir(tpath, 0777) < 0 && errno != EEXIST ) {
+    perror(tpath);
+    exit(1);
+  }
+
+  if( target == TGT_PACK && pack_open(&tpack, tpath, TRUE) < 0 ) {
+    perror(tpath);
+    exit(1);
+  }
+
+  for( i = 0 ; i < flagN ; i++ ) {
+    seed     = caseseed( base, i );
+    flagn    = !drawn;
+    lendrawn = FALSE;
+    seedstream();
+
+    capturing = TRUE;
+    clen      = 0;
+
+    if( flagx ) {
+      olen = sprintf(obuf, "%lld\n", seed);
+    }
+
+    if( !flagL ) {
+      out_write( pro, plen );
+    }
+
+    fuzz();
+
+    if( !flagL ) {
+      out_write( epi, elen );
+    }
+
+    out_flush();
+
+    capturing = FALSE;
+
+    putcase( i );
+    counts.cases++;
+
+    if( man != NULL ) {
+      putrecord( man );
+    }
+  }
+
+  if( target == TGT_PACK ) {
+    if( pack_commit(&tpack) < 0 ) {
+      perror(tpath);
+      exit(1);
+    }
+
+    pack_close( &tpack );
+  }
+
+  if( man != NULL && fclose(man) == EOF ) {
+    perror(manfile);
+    exit(1);
+  }
+
+  free( cbuf );
+}
+
+
+/*
+ * Write case "i", which is in "cbuf", to the -T target
+ */
+void putcase( long long i ) {
+  struct iovec iov[2];
+  char         name[4096], rec[RECMAX], head[32];
+  FILE        *f;
+  int          fd;
+
+
+  switch( target ) {
+    case TGT_STREAM:
+      iov[0].iov_base = head;
+      iov[0].iov_len  = sprintf(head, "%llu\n", (unsigned long long) clen);
+      iov[1].iov_base = cbuf;
+      iov[1].iov_len  = clen;
+
+      if( flago && (tee_write(&otee, head, iov[0].iov_len) < 0 ||
+                    tee_write(&otee, cbuf, clen) < 0) ) {
+        perror(outfile);
+        exit(1);
+      }
+
+      if( sendout(iov, 2) < 0 ) {
+        outfail();
+      }
+      break;
+
+    case TGT_DIR:
+      snprintf(name, sizeof(name), "%s/%lld", tpath, i);
+
+      if( (fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0 ) {
+        perror(name);
+        exit(1);
+      }
+
+      /* The size is known: let the file system lay it out in one piece */
+      if( flagF && clen > 0 && fallocate(fd, 0, 0, clen) < 0 &&
+          errno != EOPNOTSUPP ) {
+        perror(name);
+        exit(1);
+      }
+
+      iov[0].iov_base = cbuf;
+      iov[0].iov_len  = clen;
+
+      if( writev_all(fd, iov, 1) < 0 || close(fd) < 0 ) {
+        perror(name);
+        exit(1);
+      }
+      break;
+
+    case TGT_PACK:
+      /* The metadata of the case is its record, without the LF */
+      if( (f = fmemopen(rec, sizeof(rec), "w")) == NULL ) {
+        perror(progname);
+        exit(1);
+      }
+
+      putrecord( f );
+      (void) fclose( f );
+      rec[strcspn(rec, "\n")] = 0;
+
+      if( flagF && clen > 0 && fallocate(tpack.fd, 0, tpack.end, clen) < 0 &&
+          errno != EOPNOTSUPP ) {
+        perror(tpath);
+        exit(1);
+      }
+
+      if( pack_append(&tpack, cbuf, clen, rec, strlen(rec), NULL) < 0 ) {
+        perror(tpath);
+        exit(1);
+      }
+      break;
+  }
+}
+
+
+/*
+ * Seed of case "i" of a batch made from "base": a splitmix64 step,
+ * so that neighbouring cases get unrelated seeds
+ */
+long long caseseed( long long base, long long i ) {
+  uint64_t z = (uint64_t) base + (uint64_t) (i + 1) * 0x9e3779b97f4a7c15ULL;
+
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return( (long long) (z ^ (z >> 31)) );
+}
+
+
+/*
+ * Append "n" bytes at "p" to the case being made
+ */
+void capture( char *p, int n ) {
+  size_t want;
+
+
+  if( clen + n > csize ) {
+    for( want = csize ? csize : OBUFSIZ ; want < clen + n ; want *= 2 )
+      ;
+
+    if( (cbuf = realloc(cbuf, want)) == NULL ) {
+      perror(progname);
+      exit(1);
+    }
+
+    csize = want;
+  }
+
+  memcpy( cbuf + clen, p, n );
+  clen += n;
+}
+
+
+/*
+ * Write the one line record of the stream for -O: everything that
+ * decides its characters, and not the characters themselves.  The
+ * epilog comes last and runs to the end of the line.  Prologue and
+ * epilog are written as compiled, with octal escapes for anything
+ * that would break the record, which unescape() turns back into the
+ * same characters.
+ */
+void putrecord( FILE *f ) {
+  static char *gens[] = { "rand", "xoshiro", "philox" };
+  char         prob[32];
+
+
+  fprintf(f, "fuzzrec v=%d gen=%s seed=%lld length=%lld l=%d nul=%d all=%d x=%d",
+          STREAMVERSION, gens[gen], seed, length, flagl, flag0, flaga, flagx);
+
+  /* The draw of a random length moves the generator: redo it */
+  if( lendrawn ) {
+    fprintf(f, " drawn=1");
+  }
+
+  if( flagS ) {
+    fprintf(f, " from=%lld count=%lld", rfrom, rlen);
+  }
+
+  if( flagw ) {
+    fprintf(f, " w=%s", wspec);
+  }
+
+  /* Shortest form of the probability that reads back the same */
+  if( flagD ) {
+    sprintf(prob, "%.15g", flagi);
+
+    if( strtod(prob, NULL) != flagi ) {
+      sprintf(prob, "%.17g", flagi);
+    }
+
+    fprintf(f, " D=");
+    putesc( f, dpath, strlen(dpath) );
+    fprintf(f, " i=%s", prob);
+  }
+
+  if( flagm ) {
+    fprintf(f, " m=");
+    putesc( f, mpath, strlen(mpath) );
+    fprintf(f, " ops=%s", mut.ops);
+  }
+
+  if( flagL ) {
+    fprintf(f, " L=1");
+  }
+
+  if( flagb ) {
+    fprintf(f, " b=");
+    putesc( f, pro, plen );
+  }
+
+  if( flage ) {
+    fprintf(f, " e=");
+    putesc( f, epi, elen );
+  }
+
+  putc('\n', f);
+}
+
+
+/*
+ * Write "n" bytes at "p" to "f", with anything but graphic ASCII
+ * characters as octal escapes
+ */
+void putesc( FILE *f, char *p, int n ) {
+  for( ; n > 0 ; n--, p++ ) {
+    if( isgraph((unsigned char) *p) && *p != '\\' ) {
+      putc(*p, f);
+    }
+    else {
+      fprintf(f, "\\%03o", (unsigned char) *p);
+    }
+  }
+}
+
+
+/*
+ * Make "path", of a file just opened, absolute, so that a record
+ * naming it can be replayed from anywhere
+ */
+void abspath( char *path ) {
+  char *abs;
+
+
+  if( (abs = realpath(path, NULL)) != NULL ) {
+    if( strlen(abs) < RECMAX ) {
+      strcpy(path, abs);
+    }
+
+    free( abs );
+  }
+}
+
+
+/*
+ * Read a path written by putesc() at "s" into "path".  Returns -1 if
+ * it is too long.
+ */
+int getpath( char *s, char *path ) {
+  char *end;
+  int   n;
+
+
+  if( strlen(s) >= RECMAX ) {
+    return( -1 );
+  }
+
+  n = unescape( s, 0, path, &end );
+  path[n] = 0;
+
+  return( 0 );
+}
+
+
+/*
+ * Set the options from a record written by putrecord().  Returns -1
+ * if "line" is not a record, or one for a different stream version.
+ */
+int getrecord( char *line ) {
+  char *s, *e;
+  int   v = -1;
+
+
+  if( strncmp(line, "fuzzrec ", 8) != 0 ) {
+    return( -1 );
+  }
+
+  flags = flagn = TRUE;
+  flagl = flag0 = flagx = flagS = flage = flagw = flagm = flagops = flagD = FALSE;
+  flagb = flagL = FALSE;
+  flaga = TRUE;
+  flagi = 0.05;
+  epilog[0] = prolog[0] = 0;
+
+  if( (e = strchr(line, '\n')) != NULL ) {
+    *e = 0;
+  }
+
+  /*
+   * The epilog is the rest of the line, spaces included in records of
+   * old.  It is written last, and every field before it is escaped and
+   * has no spaces, so the first " e=" is where it starts.
+   */
+  if( (e = strstr(line, " e=")) != NULL ) {
+    *e = 0;
+
+    if( strlen(e + 3) >= sizeof(epilog) ) {
+      return( -1 );
+    }
+
+    strcpy(epilog, e + 3);
+    flage = TRUE;
+  }
+
+  for( s = strtok(line + 8, " ") ; s != NULL ; s = strtok(NULL, " ") ) {
+    if( sscanf(s, "v=%d", &v) == 1 || sscanf(s, "seed=%lld", &seed) == 1 ||
+        sscanf(s, "length=%lld", &length) == 1 ||
+        sscanf(s, "l=%d", &flagl) == 1 || sscanf(s, "nul=%d", &flag0) == 1 ||
+        sscanf(s, "all=%d", &flaga) == 1 || sscanf(s, "x=%d", &flagx) == 1 ||
+        sscanf(s, "from=%lld", &rfrom) == 1 || sscanf(s, "i=%lf", &flagi) == 1 ) {
+      continue;
+    }
+
+    if( strcmp(s, "drawn=1") == 0 ) {
+      flagn = FALSE;
+      continue;
+    }
+
+    if( strcmp(s, "L=1") == 0 ) {
+      flagL = TRUE;
+      continue;
+    }
+
+    if( sscanf(s, "count=%lld", &rlen) == 1 ) {
+      flagS = TRUE;
+    }
+    else if( strcmp(s, "gen=rand") == 0 ) {
+      gen = GEN_RAND;
+    }
+    else if( strcmp(s, "gen=xoshiro") == 0 ) {
+      gen = GEN_XOSHIRO;
+    }
+    else if( strcmp(s, "gen=philox") == 0 ) {
+      gen = GEN_PHILOX;
+    }
+    else if( strncmp(s, "w=", 2) == 0 ) {
+      strcpy(wspec, s + 2);
+      flagw = TRUE;
+    }
+    else if( strncmp(s, "b=", 2) == 0 ) {
+      strcpy(prolog, s + 2);
+      flagb = TRUE;
+    }
+    else if( strncmp(s, "D=", 2) == 0 && getpath(s + 2, dpath) == 0 ) {
+      flagD = TRUE;
+    }
+    else if( strncmp(s, "m=", 2) == 0 && getpath(s + 2, mpath) == 0 ) {
+      flagm = TRUE;
+    }
+    else if( strncmp(s, "ops=", 4) == 0 && strlen(s + 4) < sizeof(mops) ) {
+      strcpy(mops, s + 4);
+      flagops = TRUE;
+    }
+    else {
+      return( -1 );
+    }
+  }
+
+  return( v == STREAMVERSION ? 0 : -1 );
+}
+
+
+/*
+ * Turn "wspec" into "weights".  Bytes that -0, -a and -p let through
+ * start with weight 1, the others with 0; each "item=weight" then
+ * sets the weight of the bytes of "item".
+ */
+void setweights() {
+  char   spec[RECMAX], *s, *eq, *end;
+  double w;
+  int    c, lo, hi, (*is)(int);
+
+
+  if( gen == GEN_RAND ) {
+    fprintf(stderr, "%s: -w needs -g xoshiro or philox\n", progname);
+    exit(1);
+  }
+
+  for( c = 0 ; c < 256 ; c++ ) {
+    weights[c] = flaga ? c != 0 : (c >= 32 && c <= 126);
+
+    if( c == 0 && flag0 ) {
+      weights[c] = 1;
+    }
+  }
+
+  strcpy(spec, wspec);
+
+  for( s = strtok(spec, ",") ; s != NULL ; s = strtok(NULL, ",") ) {
+    if( (eq = strrchr(s, '=')) == NULL ) {
+      goto bad;
+    }
+
+    *eq = 0;
+    w   = strtod(eq + 1, &end);
+
+    if( eq[1] == 0 || *end != 0 || !(w >= 0) || byteclass(s, &lo, &hi, &is) < 0 ) {
+      goto bad;
+    }
+
+    for( c = lo ; c <= hi ; c++ ) {
+      if( is == NULL || (*is)(c) ) {
+        weights[c] = w;
+      }
+    }
+  }
+
+  for( c = 0 ; c < 256 && weights[c] == 0 ; c++ )
+    ;
+
+  if( c < 256 && strpbrk(wspec, " \t") == NULL ) {
+    return;
+  }
+
+bad:
+  fprintf(stderr, "%s: bad weights \"%s\"\n", progname, wspec);
+  exit(1);
+}
+
+
+/*
+ * The bytes named by a -w item: those from "lo" to "hi" for which
+ * "is", if not NULL, is true.  Returns -1 for an unknown item.
+ */
+int byteclass( char *item, int *lo, int *hi, int (**is)(int) ) {
+  static struct {
+    char *name;
+    int   lo, hi;
+    int (*is)(int);
+  } names[] = {
+    { "nul", 0, 0, NULL },     { "esc", 27, 27, NULL },  { "del", 127, 127, NULL },
+    { "lf", 10, 10, NULL },    { "cr", 13, 13, NULL },   { "tab", 9, 9, NULL },
+    { "all", 0, 255, NULL },   { "high", 128, 255, NULL },
+    { "print", 0, 127, isprint }, { "graph", 0, 127, isgraph },
+    { "cntrl", 0, 127, iscntrl }, { "space", 0, 127, isspace },
+    { "punct", 0, 127, ispunct }, { "alpha", 0, 127, isalpha },
+    { "alnum", 0, 127, isalnum }, { "digit", 0, 127, isdigit },
+    { "upper", 0, 127, isupper }, { "lower", 0, 127, islower },
+    { "xdigit", 0, 127, isxdigit }
+  };
+  char  *end;
+  long   a, b;
+  size_t i;
+
+
+  *is = NULL;
+
+  for( i = 0 ; i < sizeof(names) / sizeof(names[0]) ; i++ ) {
+    if( strcmp(item, names[i].name) == 0 ) {
+      *lo = names[i].lo;
+      *hi = names[i].hi;
+      *is = names[i].is;
+      return( 0 );
+    }
+  }
+
+  /* ^X is control-X, ^? is DEL */
+  if( item[0] == '^' && item[1] != 0 && item[2] == 0 ) {
+    *lo = *hi = item[1] == '?' ? 127 : toupper((unsigned char) item[1]) & 0x1f;
+    return( 0 );
+  }
+
+  a = b = strtol(item, &end, 0);
+
+  if( end != item && *end == '-' ) {
+    item = end + 1;
+    b    = strtol(item, &end, 0);
+  }
+
+  if( end == item || *end != 0 || a < 0 || b > 255 || a > b ) {
+    return( -1 );
+  }
+
+  *lo = (int) a;
+  *hi = (int) b;
+
+  return( 0 );
+}
+
+
+/*
+ * Load the -D dictionary into "dict".  Each line holds a token in
+ * double quotes with C escapes, after a weight (1 if none) or an
+ * AFL style "name=".  Blank lines and lines starting with # are
+ * skipped.
+ */
+void loaddict() {
+  char   line[RECMAX], tok[RECMAX], *s;
+  double w;
+  int    n, no = 0;
+  FILE  *f;
+
+
+  if( (f = fopen(dpath, "r")) == NULL ) {
+    perror(dpath);
+    exit(1);
+  }
+
+  abspath( dpath );
+
+  while( fgets(line, sizeof(line), f) != NULL ) {
+    no++;
+
+    for( s = line ; isspace((unsigned char) *s) ; s++ ) {
+      ;
+    }
+
+    if( *s == 0 || *s == '#' ) {
+      continue;
+    }
+
+    w = 1;
+
+    if( isdigit((unsigned char) *s) || *s == '.' ) {
+      w = strtod(s, &s);
+    }
+    else if( isalpha((unsigned char) *s) || *s == '_' ) {
+      while( isalnum((unsigned char) *s) || *s == '_' || *s == '@' ) {
+        s++;
+      }
+
+      if( *s++ != '=' ) {
+        goto bad;
+      }
+    }
+
+    while( isspace((unsigned char) *s) ) {
+      s++;
+    }
+
+    if( *s != '"' ) {
+      goto bad;
+    }
+
+    n = unescape( s + 1, '"', tok, &s );
+
+    if( *s != '"' ) {
+      goto bad;
+    }
+
+    for( s++ ; isspace((unsigned char) *s) ; s++ ) {
+      ;
+    }
+
+    if( *s != 0 || fuzzgen_dict_add(&dict, tok, n, w) < 0 ) {
+      goto bad;
+    }
+  }
+
+  if( ferror(f) ) {
+    perror(dpath);
+    exit(1);
+  }
+
+  (void) fclose(f);
+
+  if( fuzzgen_dict_build(&dict) < 0 ) {
+    fprintf(stderr, "%s: %s: no tokens\n", progname, dpath);
+    exit(1);
+  }
+
+  /* Gaps between tokens with -g rand, as libfuzzgen makes them */
+  dgapmax = (long long) (2 * (1 - flagi) / flagi + 0.5) + 1;
+
+  return;
+
+bad:
+  fprintf(stderr, "%s: %s:%d: bad token (at most %d bytes)\n", progname,
+          dpath, no, FUZZGEN_TOKMAX);
+  exit(1);
+}
+
+
+/*
+ * Copy the string at "s" to "buf" up to the character "q" or its
+ * end, turning C escapes into the characters they stand for.  Sets
+ * "end" to where it stopped and returns the number of bytes.
+ */
+int unescape( char *s, int q, char *buf, char **end ) {
+  int n = 0, c, i;
+
+
+  while( *s != 0 && *s != q ) {
+    if( *s != '\\' || s[1] == 0 ) {
+      buf[n++] = *s++;
+      continue;
+    }
+
+    switch( *(++s) ) {
+      case 'a':
+        c = '\a';
+        break;
+
+      case 'b':
+        c = '\b';
+        break;
+
+      case 'e':
+        c = 033;
+        break;
+
+      case 'f':
+        c = '\f';
+        break;
+
+      case 'n':
+        c = '\n';
+        break;
+
+      case 'r':
+        c = '\r';
+        break;
+
+      case 't':
+        c = '\t';
+        break;
+
+      case 'v':
+        c = '\v';
+        break;
+
+      case 'x':
+        for( c = 0, i = 0 ; i < 2 && isxdigit((unsigned char) s[1]) ; i++ ) {
+          s++;
+          c = c * 16 + (isdigit((unsigned char) *s) ? *s - '0'
+                                                    : tolower((unsigned char) *s) - 'a' + 10);
+        }
+        break;
+
+      default:
+        if( *s >= '0' && *s <= '7' ) {
+          for( c = *s - '0', i = 1 ; i < 3 && s[1] >= '0' && s[1] <= '7' ; i++ ) {
+            c = c * 8 + *(++s) - '0';
+          }
+        }
+        else {
+          c = (unsigned char) *s;       /* \\, \" and the like */
+        }
+    }
+
+    buf[n++] = (char) c;
+    s++;
+  }
+
+  *end = s;
+
+  return( n );
+}
+
+
+/*
+ * Replay characters in "in".  Without -d and -o a regular file goes
+ * to stdout by zerocopy(); with -d or -o it is mapped, and paced or
+ * recorded out of the mapping.  Anything else is read in blocks.
+ */
+void replay() {
+  struct stat st;
+  char       *map;
+  off_t       off, n;
+  int         c, fd;
+
+
+  out_flush();
+
+  if( packed ) {
+    replaypack();
+    return;
+  }
+
+  fd  = fileno(in);
+  off = 0;
+
+  if( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 ) {
+    if( !paced && !flago && !counting && flagq == NULL ) {
+      off = zerocopy( fd, st.st_size );
+    }
+    else if( (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                         fd, 0)) != MAP_FAILED ) {
+      (void) madvise( map, st.st_size, MADV_SEQUENTIAL );
+
+      if( paced ) {
+        for( off = 0 ; off < st.st_size ; off++ ) {
+          putch( map[off] );
+        }
+      }
+      else {
+        for( off = 0 ; off < st.st_size ; off += n ) {
+          n = st.st_size - off < MAPPIECE ? st.st_size - off : MAPPIECE;
+          out_write( map + off, (int) n );
+        }
+      }
+
+      (void) munmap( map, st.st_size );
+      return;
+    }
+
+    if( off == st.st_size ) {
+      return;
+    }
+
+    if( fseeko(in, off, SEEK_SET) != 0 ) {
+      perror(infile);
+      exit(1);
+    }
+  }
+
+  if( paced ) {
+    while(  (c = getc(in)) != EOF  ) {
+      putch(c);
+    }
+
+    return;
+  }
+
+  /* No pacing: read straight into the output buffer */
+  for( ;; ) {
+    if( olen == OBUFSIZ ) {
+      out_flush();
+    }
+
+    if( (n = fread(obuf + olen, 1, OBUFSIZ - olen, in)) <= 0 ) {
+      break;
+    }
+
+    olen += n;
+  }
+
+  if( ferror(in) ) {
+    perror(infile);
+    exit(1);
+  }
+}
+
+
+/*
+ * "infile" is not a file: open it as "pack:id" or "pack:from-to".
+ * Returns -1 with errno set if it is not that either.
+ */
+int openpacked() {
+  char *path;
+
+
+  if( pack_range(infile, &path, &pfrom, &pto) < 0 ) {
+    if( errno == EINVAL ) {
+      fprintf(stderr, "%s: %s: case ids must be ID or FROM-TO, FROM <= TO\n",
+              progname, infile);
+      exit(1);
+    }
+
+    errno = ENOENT;
+    return( -1 );
+  }
+
+  if( pack_open(&rpack, path, FALSE) < 0 ) {
+    free( path );
+    return( -1 );
+  }
+
+  free( path );
+  packed = TRUE;
+
+  return( 0 );
+}
+
+
+/*
+ * Replay cases "pfrom" to "pto" of the pack one after the other,
+ * straight out of its mapping.
+ */
+void replaypack() {
+  struct packent e;
+  uint64_t       id, off, n;
+
+
+  (void) madvise( rpack.map, rpack.size, MADV_SEQUENTIAL );
+
+  for( id = pfrom ; ; id++ ) {
+    if( pack_find(&rpack, id, &e) < 0 ) {
+      fprintf(stderr, "%s: %s: no case %llu\n", progname, infile,
+              (unsigned long long) id);
+      exit(1);
+    }
+
+    for( off = 0 ; off < e.len ; off += n ) {
+      n = e.len - off < MAPPIECE ? e.len - off : MAPPIECE;
+
+      if( paced ) {
+        for( ; n > 0 ; n--, off++ ) {
+          putch( rpack.map[e.off + off] );
+        }
+      }
+      else {
+        out_write( rpack.map + e.off + off, (int) n );
+      }
+    }
+
+    /* Stop here rather than let "id" wrap past the largest id */
+    if( id == pto ) {
+      break;
+    }
+  }
+}
+
+
+/*
+ * Copy "size" bytes of "fd" to stdout inside the kernel: splice()
+ * into a pipe, else copy_file_range() to a file, else sendfile().
+ * Returns how far it got; the caller copies the rest by hand if a
+ * call is not supported for these descriptors.
+ */
+off_t zerocopy( int fd, off_t size ) {
+  off_t       off = 0;
+  ssize_t     n   = -1;
+  struct stat st;
+  int         how;
+
+
+#ifdef __linux__
+  how = (fstat(1, &st) == 0 && S_ISFIFO(st.st_mode)) ? 0 : 1;
+
+  while( off < size ) {
+    switch( how ) {
+      case 0:
+        n = splice( fd, &off, 1, NULL, size - off, SPLICE_F_MORE );
+        break;
+
+      case 1:
+        n = copy_file_range( fd, &off, 1, NULL, size - off, 0 );
+        break;
+
+      case 2:
+        n = sendfile( 1, fd, &off, size - off );
+        break;
+    }
+
+    if( n > 0 ) {
+      continue;
+    }
+
+    if( n == 0 ) {              /* File got shorter */
+      break;
+    }
+
+    if( errno == EINTR || errno == EAGAIN ) {
+      continue;
+    }
+
+    if( errno == EPIPE || errno == ENOSPC || errno == EIO ) {
+      perror(progname);
+      exit(1);
+    }
+
+    /* Not supported here: try the next way, or give up */
+    if( how == 1 ) {
+      how = 2;
+    }
+    else {
+      break;
+    }
+  }
+#endif
+
+  return( off );
+}
+
+
+/*
+ * Decide the effective range of the random characters 
  * Every random character is of the form c = rand() % m + h 
  */
 void fuzz() {
@@ -326,7 +1923,18 @@ void fuzz() {
     m = 95 + (flag0 != FALSE); /* Printables, 32-126 */
   }
 
-  if( flagl ) {
+  if( flagm ) {
+    putmutant();
+  }
+  else if( gen != GEN_RAND ) {
+    if( nthreads > 1 && !paced ) {
+      fuzzthreads();
+    }
+    else {
+      fuzzchunks();
+    }
+  }
+  else if( flagl ) {
     fuzzstr(  m, h );
   }
   else {
@@ -336,165 +1944,599 @@ void fuzz() {
 
 
 /*
- * Output a character to standard out with delay 
+ * Output the mutant, piece by piece
+ */
+void putmutant() {
+  long long len, off, n;
+  char     *p;
+  int       i;
+
+
+  for( i = 0 ; i < mut.npcs ; i++ ) {
+    p = mut_piece( &mut, i, &len );
+
+    for( off = 0 ; off < len ; off += n ) {
+      n = len - off < MAPPIECE ? len - off : MAPPIECE;
+
+      if( paced ) {
+        for( ; n > 0 ; n--, off++ ) {
+          putch( p[off] );
+        }
+      }
+      else {
+        out_write( p + off, (int) n );
+      }
+    }
+  }
+}
+
+
+/*
+ * Output a character to standard out with delay.  Characters are
+ * collected in "obuf"; with -d or -c they are flushed every burst
+ * and then paced.
  */
 void putch( int i ) {
-  char c;
+  long long t;
+  int       n;
 
 
-  c = (char) i;
+  obuf[olen++] = (char) i;
 
-  if( write(1, &c, 1) != 1 ) {
-    perror(progname);
+  if( olen == OBUFSIZ || (paced && olen >= pace.burst) ) {
+    n = olen;
+    out_flush();
+
+    if( counting ) {
+      t = stats_clock();
+      pace_sent( &pace, n );
+      counts.pacens += stats_clock() - t;
+    }
+    else {
+      pace_sent( &pace, n );
+    }
+  }
+}
+
+
+/*
+ * Append "n" bytes at "p" to the output.  Large blocks are not copied
+ * but handed to writev() together with what is already buffered.
+ */
+void out_write( char *p, int n ) {
+  struct iovec iov[2];
+
+
+  if( capturing ) {
+    out_flush();
+    capture( p, n );
+
+    if( counting ) {
+      stats_bytes( &counts, p, n );
+    }
+    return;
+  }
+
+  if( n < OBUFSIZ / 4 ) {
+    if( olen + n > OBUFSIZ ) {
+      out_flush();
+    }
+
+    memcpy( obuf + olen, p, n );
+    olen += n;
+    return;
+  }
+
+  if( counting ) {
+    stats_bytes( &counts, obuf, olen );
+    stats_bytes( &counts, p, n );
+  }
+
+  if( flago && (tee_write(&otee, obuf, olen) < 0 || tee_write(&otee, p, n) < 0) ) {
+    perror(outfile);
+    exit(1);
+  }
+
+  iov[0].iov_base = obuf;
+  iov[0].iov_len  = olen;
+  iov[1].iov_base = p;
+  iov[1].iov_len  = n;
+
+  if( sendout(iov, 2) < 0 ) {
+    outfail();
+  }
+
+  olen = 0;
+}
+
+
+/*
+ * Flush "obuf" to stdout, and to the record file with -o.  The record
+ * is given the bytes first, so that it also holds those that were
+ * being sent when the reader went away.
+ */
+void out_flush() {
+  struct iovec iov;
+
+
+  if( olen == 0 ) {
+    return;
+  }
+
+  if( counting ) {
+    stats_bytes( &counts, obuf, olen );
+  }
+
+  if( capturing ) {
+    capture( obuf, olen );
+    olen = 0;
+    return;
+  }
+
+  if( flago && tee_write(&otee, obuf, olen) < 0 ) {
+    perror(outfile);
+    exit(1);
+  }
 
+  iov.iov_base = obuf;
+  iov.iov_len  = olen;
+
+  if( sendout(&iov, 1) < 0 ) {
     if( flagr ) {
       (void)fclose( in );
     }
 
-    if( flago ) {
-      (void)fclose( out );
+    outfail();
+  }
+
+  olen = 0;
+}
+
+
+/*
+ * Send "iov" to stdout, or into the ring with -q
+ */
+int sendout( struct iovec *iov, int cnt ) {
+  long long t = 0;
+  int       i;
+
+
+  if( flagq == NULL ) {
+    return( writev_all(1, iov, cnt) );
+  }
+
+  if( counting ) {
+    t = stats_clock();
+  }
+
+  for( i = 0 ; i < cnt ; i++ ) {
+    if( ring_write(&ring, iov[i].iov_base, iov[i].iov_len) < 0 ) {
+      return( -1 );
     }
+  }
 
-    exit(1);
+  if( counting ) {
+    counts.outns += stats_clock() - t;
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Writing to stdout failed.  Complete the record, and if the reader
+ * went away, die of SIGPIPE as if it had not been held off.
+ */
+void outfail() {
+  int e = errno;
+
+
+  recordend();
+
+  if( e == EPIPE ) {
+    signal( SIGPIPE, SIG_DFL );
+    raise( SIGPIPE );
   }
 
+  errno = e;
+  perror(progname);
+  exit(1);
+}
+
+
+/*
+ * Write out the rest of the -o record, at exit too.  Errors are
+ * reported where the record is closed in main().
+ */
+void recordend() {
   if( flago ) {
-    if( write(fileno(out), &c, 1) != 1 ) {
-      perror(outfile);
-      exit(1);
-    }
+    (void) tee_close( &otee );
   }
+}
+
+
+/*
+ * writev() the whole of "iov", restarting after short writes and
+ * signals.  "iov" is consumed in the process.  Returns -1 on error.
+ */
+int writev_all( int fd, struct iovec *iov, int cnt ) {
+  ssize_t   n;
+  long long t = 0;
+
+
+  while( cnt > 0 ) {
+    if( counting ) {
+      t = stats_clock();
+    }
+
+    n = writev( fd, iov, cnt );
+
+    if( counting ) {
+      counts.outns += stats_clock() - t;
+      counts.calls++;
+    }
+
+    if( n < 0 ) {
+      if( errno == EINTR ) {
+        continue;
+      }
+
+      return( -1 );
+    }
+
+    while( cnt > 0 && (size_t) n >= iov->iov_len ) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
 
-  if( flagd ) {
-    usleep( flagd );
+    if( cnt > 0 ) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
   }
+
+  return( 0 );
 }
 
 
 /*
- * Make a random character 
+ * Make a random character with libc rand() 
  */
 void fuzzchar( int m, int h ) {
-  int i, c;
+  long long i;
+  int       c, t;
 
 
-  for( i = 0 ; i < length ; i++ ) {
+  for( i = 0 ; i < rto ; i++ ) {
+    if( (t = randtoken()) >= 0 ) {
+      if( i >= rfrom ) {
+        putbytes( dict.arena + dict.off[t], dict.len[t] );
+      }
+      continue;
+    }
+
     c = (int) (rand() % m) + h;
 
     if( flag0 && !flaga && c == 127 ) {
       c = 0;
     }
 
-    putch( c );
+    if( i >= rfrom ) {
+      putch( c );
+    }
   }
 }
 
 
 /*
- * make random strings 
+ * make random strings with libc rand() 
  */
 void fuzzstr( int m, int h ) {
-  int i, j, l, c;
+  long long i;
+  int       j, l, c, t;
 
 
-  for( i = 0 ; i < length ; i++ ) {
+  for( i = 0 ; i < rto ; i++ ) {
     l = rand() % flagl;	/* Line length  */
 
+    if( flagL && i >= rfrom ) {
+      putbytes( pro, plen );
+    }
+
     for( j = 0 ; j < l ; j++ ) {
+      if( (t = randtoken()) >= 0 ) {
+        if( i >= rfrom ) {
+          putbytes( dict.arena + dict.off[t], dict.len[t] );
+        }
+        continue;
+      }
+
       c = (int) (rand() % m) + h;
  
       if( flag0 && !flaga && c == 127 ) {
         c = 0;
       }
 
-      putch( c );
+      if( i >= rfrom ) {
+        putch( c );
+      }
+    }
+
+    if( i >= rfrom ) {
+      putch( '\n' );
     }
 
-    putch( '\n' );
+    if( flagL && i >= rfrom ) {
+      putbytes( epi, elen );
+    }
   }
 }
 
 
 /*
- * Output the "epilog" with C escape sequences 
+ * With -D and -g rand, decide whether the next character is a token
+ * as libfuzzgen does: returns the token, or -1 for a random byte
  */
-void myputs( char *s ) {
-  int c;
+int randtoken() {
+  int t;
 
 
-  while( *s != 0 ) {
-    if( *s == '\\' ) {
-      switch( *(++s) ) {
-        case 'b':
-          putch('\b');
-          break;
+  if( !flagD ) {
+    return( -1 );
+  }
 
-        case 'f':
-          putch('\f');
-          break;
+  if( dgap < 0 ) {
+    dgap = rand() % dgapmax;
+  }
 
-        case 'n':
-          putch('\n');
-          break;
+  if( dgap-- > 0 ) {
+    return( -1 );
+  }
 
-        case 'r':
-          putch('\r');
-          break;
+  t = randwide() % dict.n;
 
-        case 't':
-          putch('\r');
-          break;
+  if( (randwide() & 0xffffff) >= dict.thr[t] ) {
+    t = dict.alias[t];
+  }
 
-        case 'v':
-          putch('\v');
-          break;
+  return( t );
+}
 
-        case 'x':
-          s++;
-          (void)sscanf( s, "%2x", &c );
-          putch(c);
-          s++;
-          break;
 
-        default:
-          if( isdigit((int)*s) ) {
-            (void) sscanf(s, "%3d", &c);
-            putch(oct2dec(c));
+/*
+ * rand() with at least 24 bits for the alias thresholds.  C promises
+ * only 15; where that is all there is, two draws make 30.
+ */
+long randwide() {
+#if RAND_MAX >= 0xffffff
+  return( rand() );
+#else
+  return( ((long) (rand() & 0x7fff) << 15) | (rand() & 0x7fff) );
+#endif
+}
 
-            for( c = 0 ; c < 3 && isdigit((int)*s) ; c++ ) {
-              s++;
-            }
 
-            s--;
-          } 
-          else {
-            putch( *s );
-          }
+/*
+ * Output "n" bytes at "p", a token, prologue or epilog, with one copy
+ * into "obuf", or paced character by character
+ */
+void putbytes( char *p, int n ) {
+  if( !paced ) {
+    out_write( p, n );
+    return;
+  }
+
+  while( n-- > 0 ) {
+    putch( *p++ );
+  }
+}
+
+
+/*
+ * Allocate a chunk buffer 
+ */
+char *chunkalloc() {
+  void *p;
+
+
+  if( posix_memalign(&p, OBUFALIGN, fuzzgen_chunkbytes(fg)) != 0 ) {
+    perror(progname);
+    exit(1);
+  }
+
+  return( (char *) p );
+}
+
+
+/*
+ * Generate the part of chunk "k" that lies in the output range into
+ * "buf", from "r", which must hold the state for that chunk.  Returns
+ * the number of bytes generated.
+ */
+int genchunk( struct fuzzgen_rng *r, long long k, char *buf ) {
+  long long units, lo, hi;
+
+
+  units = fuzzgen_chunkunits(fg);
+  lo    = rfrom - k * units;
+  hi    = rto   - k * units;
+
+  if( lo < 0 ) {
+    lo = 0;
+  }
+
+  if( hi > units ) {
+    hi = units;
+  }
+
+  return( fuzzgen_genchunk(fg, r, lo, hi, buf) );
+}
+
+
+/*
+ * Generate the chunks one after the other 
+ */
+void fuzzchunks() {
+  struct fuzzgen_rng cur, r;
+  long long          k, units;
+  char              *buf;
+  int                i, n;
+
+
+  if( rfrom >= rto ) {
+    return;
+  }
+
+  buf   = chunkalloc();
+  units = fuzzgen_chunkunits( fg );
+  fuzzgen_seekchunk( fg, &cur, rfrom / units );
+
+  for( k = rfrom / units ; k * units < rto ; k++ ) {
+    fuzzgen_nextchunk( fg, &cur, &r, k );
+
+    n = genchunk( &r, k, buf );
+
+    if( paced ) {
+      for( i = 0 ; i < n ; i++ ) {
+        putch( buf[i] );
       }
-    } 
+    }
     else {
-      putch( *s );
+      out_write( buf, n );
     }
-
-    s++;
   }
+
+  free( buf );
 }
 
 
+/* Shared state of fuzzthreads() and its workers */
+pthread_mutex_t tlock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  tcond = PTHREAD_COND_INITIALIZER;
+struct slot    *slots;
+int             nslots;
+long long       tnext, tchunks, twritten;   /* In chunks from the first ... */
+long long       tfirst;                     /* ... which is this one */
+struct fuzzgen_rng tstate;
+
+
 /*
- * Octal to Decimal conversion, required by myputs() 
+ * Generate with "nthreads" worker threads.  Chunk k goes to slot
+ * k % nslots; the main thread writes the slots out in chunk order,
+ * so memory stays bounded by the number of slots.
  */
-int oct2dec( int i ) {
-  char s[8];
-  int  r = 0;
+void fuzzthreads() {
+  pthread_t   *tids;
+  struct slot *sl;
+  long long    k;
+  int          i;
+
+
+  if( rfrom >= rto ) {
+    return;
+  }
+
+  nslots   = 2 * nthreads;
+  tfirst   = rfrom / fuzzgen_chunkunits(fg);
+  tchunks  = (rto - 1) / fuzzgen_chunkunits(fg) - tfirst + 1;
+  tnext    = 0;
+  twritten = 0;
+  fuzzgen_seekchunk( fg, &tstate, tfirst );
+
+  slots = (struct slot *) calloc( nslots, sizeof(struct slot) );
+  tids  = (pthread_t *) calloc( nthreads, sizeof(pthread_t) );
+
+  if( slots == NULL || tids == NULL ) {
+    perror(progname);
+    exit(1);
+  }
 
+  for( i = 0 ; i < nslots ; i++ ) {
+    slots[i].buf   = chunkalloc();
+    slots[i].state = SLOT_FREE;
+  }
+
+  for( i = 0 ; i < nthreads ; i++ ) {
+    if( (errno = pthread_create(&tids[i], NULL, worker, NULL)) != 0 ) {
+      perror(progname);
+      exit(1);
+    }
+  }
+
+  for( k = 0 ; k < tchunks ; k++ ) {
+    sl = &slots[k % nslots];
+
+    pthread_mutex_lock( &tlock );
 
-  sprintf(s, "%d", i);
+    while( sl->state != SLOT_READY || sl->k != k ) {
+      pthread_cond_wait( &tcond, &tlock );
+    }
+
+    pthread_mutex_unlock( &tlock );
+
+    out_write( sl->buf, sl->len );
+
+    pthread_mutex_lock( &tlock );
+    sl->state = SLOT_FREE;
+    twritten  = k + 1;
+    pthread_cond_broadcast( &tcond );
+    pthread_mutex_unlock( &tlock );
+  }
+
+  for( i = 0 ; i < nthreads ; i++ ) {
+    pthread_join( tids[i], NULL );
+  }
 
-  for( i = 0 ; i < strlen(s) ; i++ ) {
-    r = r * 8 + (s[i] - '0');
+  for( i = 0 ; i < nslots ; i++ ) {
+    free( slots[i].buf );
   }
 
-  return( r );
+  free( slots );
+  free( tids );
 }
 
+
+/*
+ * Worker thread of fuzzthreads(): take the next chunk and its
+ * generator state, wait for its slot and fill it.  The workers share
+ * the chunks as they come, so "arg" is not used.
+ */
+void *worker( void *arg ) {
+  struct fuzzgen_rng r;
+  struct slot       *sl;
+  long long          k;
+
+
+  (void) arg;
+
+  for( ;; ) {
+    pthread_mutex_lock( &tlock );
+
+    if( tnext == tchunks ) {
+      pthread_mutex_unlock( &tlock );
+      return( NULL );
+    }
+
+    k = tnext++;
+    fuzzgen_nextchunk( fg, &tstate, &r, tfirst + k );
+
+    sl = &slots[k % nslots];
+
+    /* The slot is ours once chunk k - nslots has been written */
+    while( k >= twritten + nslots ) {
+      pthread_cond_wait( &tcond, &tlock );
+    }
+
+    sl->state = SLOT_BUSY;
+    sl->k     = k;
+    pthread_mutex_unlock( &tlock );
+
+    sl->len = genchunk( &r, tfirst + k, sl->buf );
+
+    pthread_mutex_lock( &tlock );
+    sl->state = SLOT_READY;
+    pthread_cond_broadcast( &tcond );
+    pthread_mutex_unlock( &tlock );
+  }
+}
@@ -0,0 +1,763 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  fuzzbench -- measure fuzz and ptyjig
+ *
+ *  Usage:  fuzzbench [option(s)]
+ *
+ *  Runs fuzz in each of its modes into a pipe and measures bytes per
+ *  second; then runs ptyjig on a stand-in target (fuzzbench itself,
+ *  as "fuzzbench cat" or "fuzzbench exit") and measures keystroke to
+ *  output latency, bulk throughput through the pty, and the time to
+ *  start and tear down a ptyjig run.  The results are written as one
+ *  JSON object, a value per line, and can be compared with those of
+ *  an earlier build.
+ *
+ *  Options:
+ *     -f path    fuzz to run (default ./fuzz)
+ *     -p path    ptyjig to run (default ./ptyjig)
+ *     -n bytes   bytes per fuzz run and through the pty (default 64M)
+ *     -k keys    keystrokes timed for latency (default 1000)
+ *     -s runs    ptyjig runs timed for start and teardown (default 20)
+ *     -r runs    best of this many runs of each fuzz mode (default 3)
+ *     -o file    write the results to "file" (default bench.json)
+ *     -c file    compare with the results in "file"; exit 1 if any
+ *                is worse by more than -t percent
+ *     -t pct     allowed slowdown with -c (default 10)
+ *
+ *  Results that could not be measured, e.g. when ptyjig finds no pty,
+ *  are null.  Names ending in _bps are bytes per second (higher is
+ *  better), in _us and _ms times (lower is better).
+ */
+
+static char *progname = "fuzzbench";
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAXRES  64              /* Results kept */
+#define NAMELEN 64
+#define BUFSIZE (1 << 16)
+#define NSEC    1000000000LL
+#define WAITMS  5000            /* Give up on ptyjig after this long */
+
+#define TRUE    1
+#define FALSE   0
+
+struct result {
+  char   name[NAMELEN];
+  double value;
+  int    ok;                    /* FALSE: not measured, null */
+};
+
+
+void      usage();
+int       standin(char *what);
+void      benchfuzz();
+void      benchlatency();
+void      benchbulk();
+void      benchspawn();
+double    fuzzrate(char **args);
+pid_t     spawn(char **args, int in, int out);
+int       finish(pid_t pid, int kill_it);
+int       ptyjig(char *what, int *in, int *out, pid_t *pid);
+int       waitbyte(int fd, int c, int ms);
+long long now();
+void      result(char *name, double value, int ok);
+void      putresults(char *path);
+int       compare(char *path);
+int       cmplong(const void *a, const void *b);
+
+char     *fuzz   = "./fuzz";
+char     *pty    = "./ptyjig";
+char     *outfile = "bench.json";
+char     *oldfile;
+long long nbytes = 64 << 20;
+int       nkeys  = 1000;
+int       nspawn = 20;
+int       nruns  = 3;
+double    slack  = 10;
+char      self[4096];           /* This program, as the stand-in target */
+char      tmpname[64];          /* The file -r replays */
+char      outname[64];          /* The file -o records in */
+
+struct result results[MAXRES];
+int       nresults;
+
+
+int main( int argc, char **argv ) {
+  ssize_t n;
+
+
+  if( argc == 2 && (strcmp(argv[1], "cat") == 0 || strcmp(argv[1], "exit") == 0) ) {
+    return( standin(argv[1]) );
+  }
+
+  while( *(++argv) != NULL ) {
+    if( (*argv)[0] != '-' || (*argv)[1] == 0 || (*argv)[2] != 0 || argv[1] == NULL ) {
+      usage();
+    }
+
+    switch( (*argv)[1] ) {
+      case 'f':
+        fuzz = *(++argv);
+        break;
+
+      case 'p':
+        pty = *(++argv);
+        break;
+
+      case 'o':
+        outfile = *(++argv);
+        break;
+
+      case 'c':
+        oldfile = *(++argv);
+        break;
+
+      case 'n':
+        if( sscanf(*(++argv), "%lld", &nbytes) != 1 || nbytes <= 0 ) {
+          usage();
+        }
+        break;
+
+      case 'k':
+        if( sscanf(*(++argv), "%d", &nkeys) != 1 || nkeys <= 0 ) {
+          usage();
+        }
+        break;
+
+      case 's':
+        if( sscanf(*(++argv), "%d", &nspawn) != 1 || nspawn <= 0 ) {
+          usage();
+        }
+        break;
+
+      case 'r':
+        if( sscanf(*(++argv), "%d", &nruns) != 1 || nruns <= 0 ) {
+          usage();
+        }
+        break;
+
+      case 't':
+        if( sscanf(*(++argv), "%lf", &slack) != 1 || slack < 0 ) {
+          usage();
+        }
+        break;
+
+      default:
+        usage();
+    }
+  }
+
+  if( (n = readlink("/proc/self/exe", self, sizeof(self) - 1)) > 0 ) {
+    self[n] = 0;
+  }
+  else {
+    fprintf(stderr, "%s: cannot find myself for the stand-in target\n", progname);
+    exit(1);
+  }
+
+  signal( SIGPIPE, SIG_IGN );
+
+  benchfuzz();
+  benchlatency();
+  benchbulk();
+  benchspawn();
+
+  putresults( outfile );
+
+  return( oldfile != NULL ? compare(oldfile) : 0 );
+}
+
+
+/*
+ * Print help screen
+ */
+void usage() {
+  printf("  Usage: \n");
+  printf("    fuzzbench [option(s)]\n\n");
+  printf("  Measure fuzz and ptyjig, and write the results as JSON\n\n");
+  printf("  Options:\n");
+  printf("     -f PATH    fuzz to run (default ./fuzz)\n");
+  printf("     -p PATH    ptyjig to run (default ./ptyjig)\n");
+  printf("     -n BYTES   bytes per fuzz run and through the pty (default 64M)\n");
+  printf("     -k KEYS    keystrokes timed for latency (default 1000)\n");
+  printf("     -s RUNS    ptyjig runs timed for start and teardown (default 20)\n");
+  printf("     -r RUNS    best of RUNS runs of each fuzz mode (default 3)\n");
+  printf("     -o FILE    write the results to FILE (default bench.json)\n");
+  printf("     -c FILE    compare with the results in FILE, exit 1 if any is\n");
+  printf("                worse by more than -t percent\n");
+  printf("     -t PCT     allowed slowdown with -c (default 10)\n\n");
+
+  exit(1);
+}
+
+
+/*
+ * The stand-in target that ptyjig runs.  "cat" puts its tty in raw
+ * mode, so that every byte comes back at once and only once, says
+ * it is ready with a "!", and copies its input to its output.
+ * "exit" just exits.
+ */
+int standin( char *what ) {
+  struct termios t;
+  char           buf[BUFSIZE];
+  ssize_t        n;
+
+
+  if( strcmp(what, "exit") == 0 ) {
+    return( 0 );
+  }
+
+  if( tcgetattr(0, &t) == 0 ) {
+    cfmakeraw( &t );
+    (void) tcsetattr( 0, TCSANOW, &t );
+  }
+
+  if( write(1, "!", 1) != 1 ) {
+    return( 1 );
+  }
+
+  while( (n = read(0, buf, sizeof(buf))) > 0 ) {
+    if( write(1, buf, n) != n ) {
+      return( 1 );
+    }
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * fuzz in each mode, into a pipe, with and without -o
+ */
+void benchfuzz() {
+  static struct {
+    char *name, *opts;
+  } modes[] = {
+    { "fuzz_all",       ""      },
+    { "fuzz_nul",       "-0"    },
+    { "fuzz_printable", "-p"    },
+    { "fuzz_lines",     "-l 80" },
+    { "fuzz_replay",    "-r"    },
+  };
+  char  *args[16], num[32], name[NAMELEN], opts[16], *s;
+  double best, r;
+  int    i, o, n, k, fd;
+
+
+  /* The file to replay, made by fuzz itself */
+  strcpy(tmpname, "/tmp/fuzzbench.XXXXXX");
+
+  if( (fd = mkstemp(tmpname)) < 0 ) {
+    perror(tmpname);
+    exit(1);
+  }
+
+  sprintf(num, "%lld", nbytes);
+  args[0] = fuzz;
+  args[1] = "-s";
+  args[2] = "1";
+  args[3] = num;
+  args[4] = NULL;
+
+  if( finish(spawn(args, -1, fd), FALSE) != 0 ) {
+    fprintf(stderr, "%s: %s does not run\n", progname, fuzz);
+    exit(1);
+  }
+
+  close( fd );
+
+  strcpy(outname, "/tmp/fuzzbench.XXXXXX");
+
+  if( (fd = mkstemp(outname)) < 0 ) {
+    perror(outname);
+    exit(1);
+  }
+
+  close( fd );
+
+  for( i = 0 ; i < (int) (sizeof(modes) / sizeof(modes[0])) ; i++ ) {
+    for( o = 0 ; o < 2 ; o++ ) {
+      n = 0;
+      args[n++] = fuzz;
+      args[n++] = "-s";
+      args[n++] = "1";
+
+      strcpy(opts, modes[i].opts);
+
+      for( s = strtok(opts, " ") ; s != NULL ; s = strtok(NULL, " ") ) {
+        args[n++] = s;
+      }
+
+      if( strcmp(modes[i].opts, "-r") == 0 ) {
+        args[n++] = tmpname;
+      }
+      else if( strcmp(modes[i].opts, "-l 80") == 0 ) {
+        /* Lines average 40.5 bytes with their LF */
+        sprintf(num, "%lld", nbytes * 2 / 81);
+        args[n++] = num;
+      }
+      else {
+        sprintf(num, "%lld", nbytes);
+        args[n++] = num;
+      }
+
+      if( o ) {
+        args[n++] = "-o";
+        args[n++] = outname;
+      }
+
+      args[n] = NULL;
+
+      for( best = -1, k = 0 ; k < nruns ; k++ ) {
+        if( (r = fuzzrate(args)) > best ) {
+          best = r;
+        }
+      }
+
+      snprintf(name, sizeof(name), "%s%s_bps", modes[i].name, o ? "_o" : "");
+      result( name, best, best >= 0 );
+    }
+  }
+
+  unlink( tmpname );
+  unlink( outname );
+}
+
+
+/*
+ * Bytes per second of one run of fuzz, read from a pipe, or -1 if
+ * it failed
+ */
+double fuzzrate( char **args ) {
+  static char buf[BUFSIZE];
+  long long   t, total = 0;
+  ssize_t     n;
+  pid_t       pid;
+  int         p[2];
+
+
+  if( pipe(p) < 0 ) {
+    perror(progname);
+    exit(1);
+  }
+
+  t   = now();
+  pid = spawn( args, -1, p[1] );
+  close( p[1] );
+
+  while( (n = read(p[0], buf, sizeof(buf))) > 0 ) {
+    total += n;
+  }
+
+  close( p[0] );
+
+  if( finish(pid, FALSE) != 0 ) {
+    return( -1 );
+  }
+
+  t = now() - t;
+
+  return( t > 0 ? total * (double) NSEC / t : -1 );
+}
+
+
+/*
+ * Time from writing a keystroke to ptyjig to reading it back from
+ * the stand-in cat: median and 99th percentile
+ */
+void benchlatency() {
+  long long *lat;
+  char       c;
+  pid_t      pid;
+  int        in, out, i, ok = FALSE;
+
+
+  if( (lat = (long long *) malloc(nkeys * sizeof(long long))) == NULL ) {
+    perror(progname);
+    exit(1);
+  }
+
+  if( ptyjig("cat", &in, &out, &pid) == 0 ) {
+    for( i = 0 ; i < nkeys ; i++ ) {
+      c      = 'a' + i % 26;
+      lat[i] = now();
+
+      if( write(in, &c, 1) != 1 || waitbyte(out, c, WAITMS) < 0 ) {
+        break;
+      }
+
+      lat[i] = now() - lat[i];
+    }
+
+    ok = i == nkeys;
+    close( in );
+    close( out );
+    finish( pid, TRUE );
+  }
+
+  if( ok ) {
+    qsort( lat, nkeys, sizeof(long long), cmplong );
+  }
+
+  result( "ptyjig_latency_median_us", ok ? lat[nkeys / 2] / 1e3 : 0, ok );
+  result( "ptyjig_latency_p99_us", ok ? lat[nkeys * 99 / 100] / 1e3 : 0, ok );
+  free( lat );
+}
+
+
+/*
+ * Bytes per second through ptyjig and the pty, to the stand-in cat
+ * and back.  Writing and reading are interleaved, so that neither
+ * side of the pty fills up.
+ */
+void benchbulk() {
+  static char    buf[BUFSIZE], data[BUFSIZE];
+  struct pollfd  pfd[2];
+  long long      t, sent = 0, got = 0;
+  ssize_t        n;
+  pid_t          pid;
+  int            in, out, i, ok = FALSE;
+
+
+  /* Lines of printable bytes: nothing a terminal would act on */
+  for( i = 0 ; i < BUFSIZE ; i++ ) {
+    data[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+  }
+
+  if( ptyjig("cat", &in, &out, &pid) == 0 ) {
+    (void) fcntl( in, F_SETFL, O_NONBLOCK );
+    t = now();
+
+    while( got < nbytes ) {
+      pfd[0].fd     = out;
+      pfd[0].events = POLLIN;
+      pfd[1].fd     = sent < nbytes ? in : -1;
+      pfd[1].events = POLLOUT;
+
+      if( poll(pfd, 2, WAITMS) <= 0 ) {
+        break;
+      }
+
+      if( pfd[1].revents & (POLLOUT | POLLERR) ) {
+        n = nbytes - sent < BUFSIZE ? nbytes - sent : BUFSIZE;
+
+        if( (n = write(in, data, n)) < 0 && errno != EAGAIN ) {
+          break;
+        }
+
+        sent += n > 0 ? n : 0;
+      }
+
+      if( pfd[0].revents & (POLLIN | POLLHUP) ) {
+        if( (n = read(out, buf, sizeof(buf))) <= 0 ) {
+          break;
+        }
+
+        got += n;
+      }
+    }
+
+    t  = now() - t;
+    ok = got >= nbytes && t > 0;
+    close( in );
+    close( out );
+    finish( pid, TRUE );
+  }
+
+  result( "ptyjig_bulk_bps", ok ? got * (double) NSEC / t : 0, ok );
+}
+
+
+/*
+ * Time to start ptyjig on a target that exits at once and see it
+ * exit, per run
+ */
+void benchspawn() {
+  char     *args[4];
+  long long t;
+  int       i, null;
+
+
+  if( (null = open("/dev/null", O_RDWR)) < 0 ) {
+    perror("/dev/null");
+    exit(1);
+  }
+
+  args[0] = pty;
+  args[1] = self;
+  args[2] = "exit";
+  args[3] = NULL;
+
+  t = now();
+
+  for( i = 0 ; i < nspawn ; i++ ) {
+    if( finish(spawn(args, null, null), FALSE) != 0 ) {
+      break;
+    }
+  }
+
+  t = now() - t;
+  close( null );
+
+  result( "ptyjig_spawn_ms", i == nspawn ? t / 1e6 / nspawn : 0, i == nspawn );
+}
+
+
+/*
+ * Start ptyjig on the stand-in target "what", with pipes to its
+ * stdin and from its stdout, and wait until the target is ready.
+ * Returns -1 if it does not get that far.
+ */
+int ptyjig( char *what, int *in, int *out, pid_t *pid ) {
+  char *args[6];
+  int   pin[2], pout[2];
+
+
+  if( pipe(pin) < 0 || pipe(pout) < 0 ) {
+    perror(progname);
+    exit(1);
+  }
+
+  args[0] = pty;
+  args[1] = "-t";
+  args[2] = "10";
+  args[3] = self;
+  args[4] = what;
+  args[5] = NULL;
+
+  *pid = spawn( args, pin[0], pout[1] );
+  close( pin[0] );
+  close( pout[1] );
+  *in  = pin[1];
+  *out = pout[0];
+
+  if( waitbyte(*out, '!', WAITMS) < 0 ) {
+    close( *in );
+    close( *out );
+    finish( *pid, TRUE );
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Read from "fd" until the byte "c" comes.  Returns -1 on end of
+ * file, error, or after "ms" milliseconds without input.
+ */
+int waitbyte( int fd, int c, int ms ) {
+  struct pollfd pfd;
+  char          buf[256];
+  ssize_t       n, i;
+
+
+  pfd.fd     = fd;
+  pfd.events = POLLIN;
+
+  for( ;; ) {
+    if( poll(&pfd, 1, ms) <= 0 || (n = read(fd, buf, sizeof(buf))) <= 0 ) {
+      return( -1 );
+    }
+
+    for( i = 0 ; i < n ; i++ ) {
+      if( buf[i] == (char) c ) {
+        return( 0 );
+      }
+    }
+  }
+}
+
+
+/*
+ * Run "args" with stdin from "in" (or /dev/null if -1) and stdout
+ * to "out"
+ */
+pid_t spawn( char **args, int in, int out ) {
+  pid_t pid;
+
+
+  if( (pid = fork()) < 0 ) {
+    perror(progname);
+    exit(1);
+  }
+
+  if( pid == 0 ) {
+    if( in < 0 ) {
+      in = open("/dev/null", O_RDONLY);
+    }
+
+    dup2( in, 0 );
+    dup2( out, 1 );
+    execvp( args[0], args );
+    perror(args[0]);
+    _exit(127);
+  }
+
+  return( pid );
+}
+
+
+/*
+ * Wait for "pid", killing it first if "kill_it".  Returns its exit
+ * status, or -1 if it did not exit normally.
+ */
+int finish( pid_t pid, int kill_it ) {
+  int status;
+
+
+  if( kill_it ) {
+    kill( pid, SIGTERM );
+  }
+
+  while( waitpid(pid, &status, 0) < 0 ) {
+    if( errno != EINTR ) {
+      return( -1 );
+    }
+  }
+
+  return( WIFEXITED(status) ? WEXITSTATUS(status) : -1 );
+}
+
+
+long long now() {
+  struct timespec t;
+
+
+  clock_gettime( CLOCK_MONOTONIC, &t );
+
+  return( (long long) t.tv_sec * NSEC + t.tv_nsec );
+}
+
+
+int cmplong( const void *a, const void *b ) {
+  long long x = *(const long long *) a, y = *(const long long *) b;
+
+
+  return( x < y ? -1 : x > y );
+}
+
+
+void result( char *name, double value, int ok ) {
+  if( nresults == MAXRES ) {
+    return;
+  }
+
+  snprintf(results[nresults].name, NAMELEN, "%s", name);
+  results[nresults].value = value;
+  results[nresults].ok    = ok;
+  nresults++;
+
+  if( ok ) {
+    fprintf(stderr, "%-28s %14.3f\n", name, value);
+  }
+  else {
+    fprintf(stderr, "%-28s %14s\n", name, "-");
+  }
+}
+
+
+/*
+ * One JSON object, one result per line, so that compare() and line
+ * based tools can read it back easily
+ */
+void putresults( char *path ) {
+  FILE *f;
+  int   i;
+
+
+  if( (f = fopen(path, "w")) == NULL ) {
+    perror(path);
+    exit(1);
+  }
+
+  fprintf(f, "{\n");
+
+  for( i = 0 ; i < nresults ; i++ ) {
+    if( results[i].ok ) {
+      fprintf(f, "  \"%s\": %.6f%s\n", results[i].name, results[i].value,
+              i + 1 < nresults ? "," : "");
+    }
+    else {
+      fprintf(f, "  \"%s\": null%s\n", results[i].name, i + 1 < nresults ? "," : "");
+    }
+  }
+
+  fprintf(f, "}\n");
+
+  if( fclose(f) == EOF ) {
+    perror(path);
+    exit(1);
+  }
+}
+
+
+/*
+ * Compare the results with those in "path", as written by
+ * putresults().  Returns 1 if any got worse by more than "slack"
+ * percent.
+ */
+int compare( char *path ) {
+  char   line[256], name[NAMELEN];
+  double old, change;
+  FILE  *f;
+  int    i, worse = 0, higher;
+
+
+  if( (f = fopen(path, "r")) == NULL ) {
+    perror(path);
+    exit(1);
+  }
+
+  while( fgets(line, sizeof(line), f) != NULL ) {
+    if( sscanf(line, " \"%63[^\"]\": %lf", name, &old) != 2 || old <= 0 ) {
+      continue;
+    }
+
+    for( i = 0 ; i < nresults && strcmp(results[i].name, name) != 0 ; i++ ) {
+      ;
+    }
+
+    if( i == nresults || !results[i].ok ) {
+      continue;
+    }
+
+    /* Positive change is better */
+    higher = strstr(name, "_bps") != NULL;
+    change = (results[i].value - old) / old * 100;
+
+    if( !higher ) {
+      change = -change;
+    }
+
+    fprintf(stderr, "%-28s %+8.1f%%%s\n", name, change,
+            change < -slack ? "  WORSE" : "");
+
+    if( change < -slack ) {
+      worse = 1;
+    }
+  }
+
+  (void) fclose(f);
+
+  return( worse );
+}
@@ -0,0 +1,1331 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  libfuzzgen, see fuzzgen.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define X86
+#include <immintrin.h>
+#endif
+
+#include "fuzzgen.h"
+
+
+static void     xseed(struct fuzzgen_rng *r, uint64_t s);
+static uint64_t xnext(struct fuzzgen_rng *r);
+static void     xjump(struct fuzzgen_rng *r);
+static void     pseed(struct fuzzgen_rng *r, uint64_t s);
+static uint64_t pnext(struct fuzzgen_rng *r);
+static uint64_t xbelow(struct fuzzgen_rng *r, uint64_t n);
+static void     setmap(struct fuzzgen *g);
+static void     nextunits(struct fuzzgen *g);
+static void     dropbytes(struct fuzzgen *g, struct fuzzgen_rng *r, long long n);
+static void     dropunits(struct fuzzgen *g, struct fuzzgen_rng *r, long long n);
+static void     fillbytes(struct fuzzgen *g, struct fuzzgen_rng *r, char *p, int n);
+static int      fillunits(struct fuzzgen *g, struct fuzzgen_rng *r, char *p, int n);
+static int      putline(struct fuzzgen *g, struct fuzzgen_rng *r, char *p, int l);
+static long long unitbytes(struct fuzzgen *g);
+static int      picktoken(const struct fuzzgen_dict *d, struct fuzzgen_rng *r);
+static void     fillalias(struct fuzzgen *g, struct fuzzgen_rng *r, char *p, int n);
+static int      setalias(struct fuzzgen *g, const double *w);
+static void     pickkernel(void);
+static int      usekernel(const char *name);
+static int      map_scalar(const struct fuzzgen *g, const uint16_t *x, int nx,
+                           char *p, int n);
+#ifdef X86
+static int      map_sse2(const struct fuzzgen *g, const uint16_t *x, int nx,
+                         char *p, int n);
+static int      map_avx2(const struct fuzzgen *g, const uint16_t *x, int nx,
+                         char *p, int n);
+static int      map_avx512(const struct fuzzgen *g, const uint16_t *x, int nx,
+                           char *p, int n);
+#endif
+static void     alias_scalar(const struct fuzzgen *g, const uint32_t *x,
+                             char *p, int n);
+#ifdef X86
+static void     alias_avx2(const struct fuzzgen *g, const uint32_t *x,
+                           char *p, int n);
+#endif
+
+/*
+ * Lane to byte kernel, picked for the CPU once per process by
+ * pickkernel() or forced with fuzzgen_kernel()
+ */
+static int (*mapkern)(const struct fuzzgen *g, const uint16_t *x, int nx,
+                      char *p, int n) = map_scalar;
+static void (*aliaskern)(const struct fuzzgen *g, const uint32_t *x,
+                         char *p, int n) = alias_scalar;
+static const char    *kernname = "scalar";
+static pthread_once_t kernonce = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Make a generator for the stream of "seed" with options "o".
+ * Returns NULL with errno set on failure, EOVERFLOW if a line of
+ * "o->lines" of the longest units is more than an int can count.
+ */
+struct fuzzgen *fuzzgen_init( const struct fuzzgen_opts *o, uint64_t seed ) {
+  struct fuzzgen *g;
+
+
+  if( (o->gen != FUZZGEN_XOSHIRO && o->gen != FUZZGEN_PHILOX) || o->lines < 0 ||
+      o->headlen < 0 || o->taillen < 0 ||
+      (o->dict != NULL && (o->dict->thr == NULL || !(o->dictp > 0 && o->dictp <= 1))) ) {
+    errno = EINVAL;
+    return( NULL );
+  }
+
+  if( (g = (struct fuzzgen *) malloc(sizeof(*g))) == NULL ) {
+    return( NULL );
+  }
+
+  pthread_once( &kernonce, pickkernel );
+
+  g->opts         = *o;
+  g->opts.weights = NULL;
+  g->opts.dict    = NULL;
+  g->opts.head    = o->headlen > 0 ? o->head : "";
+  g->opts.tail    = o->taillen > 0 ? o->tail : "";
+  g->weighted     = o->weights != NULL;
+  g->dict         = o->dict;
+  g->unit         = 1;
+  setmap( g );
+
+  /*
+   * Gaps between tokens are uniform in [0, 2 (1 - p) / p], so that
+   * on average a fraction p of the units are tokens, and one draw
+   * covers a whole gap.
+   */
+  if( g->dict != NULL ) {
+    g->gapmax = (uint64_t) (2 * (1 - o->dictp) / o->dictp + 0.5) + 1;
+    g->unit   = g->dict->maxlen;
+  }
+
+  if( unitbytes(g) > INT_MAX ) {
+    free( g );
+    errno = EOVERFLOW;
+    return( NULL );
+  }
+
+  if( g->weighted && setalias(g, o->weights) < 0 ) {
+    free( g );
+    errno = EINVAL;
+    return( NULL );
+  }
+
+  if( o->gen == FUZZGEN_PHILOX ) {
+    pseed( &g->seed, seed );
+  }
+  else {
+    xseed( &g->seed, seed );
+  }
+
+  fuzzgen_seek( g, 0 );
+
+  return( g );
+}
+
+
+void fuzzgen_free( struct fuzzgen *g ) {
+  free( g );
+}
+
+
+/*
+ * A random length in [0, n), n > 0, drawn as fuzz does when it is
+ * given none.  The draw moves the seeding state, and with it the
+ * whole stream, which starts over from its beginning.
+ */
+long long fuzzgen_drawlength( struct fuzzgen *g, long long n ) {
+  long long l = (long long) xbelow(&g->seed, (uint64_t) n);
+
+
+  fuzzgen_seek( g, 0 );
+
+  return( l );
+}
+
+
+/*
+ * Set the generator so that the next fuzzgen_fill() or fuzzgen_lines()
+ * starts at byte (or line) "unit" of the stream.  Only the chunk
+ * that holds it is generated up to there.
+ */
+void fuzzgen_seek( struct fuzzgen *g, long long unit ) {
+  long long k = unit / fuzzgen_chunkunits(g);
+
+
+  fuzzgen_seekchunk( g, &g->cur, k );
+  g->k = k - 1;
+  nextunits( g );
+
+  dropunits( g, &g->r, unit - k * fuzzgen_chunkunits(g) );
+  g->left -= unit - k * fuzzgen_chunkunits(g);
+}
+
+
+/*
+ * Go on to the next chunk
+ */
+static void nextunits( struct fuzzgen *g ) {
+  g->k++;
+  fuzzgen_nextchunk( g, &g->cur, &g->r, g->k );
+  g->left = fuzzgen_chunkunits( g );
+}
+
+
+/*
+ * A random number in [0, n), n > 0, for callers that want numbers
+ * rather than bytes.  It moves the stream on.
+ */
+uint64_t fuzzgen_below( struct fuzzgen *g, uint64_t n ) {
+  return( xbelow(&g->r, n) );
+}
+
+
+/*
+ * Put the next "n" bytes of the stream in "buf".  Returns -1 with
+ * errno EINVAL if the stream is made of lines or has tokens in it.
+ */
+int fuzzgen_fill( struct fuzzgen *g, char *buf, size_t n ) {
+  size_t m;
+
+
+  if( g->opts.lines || g->dict != NULL ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  while( n > 0 ) {
+    if( g->left == 0 ) {
+      nextunits( g );
+    }
+
+    m = n < (size_t) g->left ? n : (size_t) g->left;
+
+    fillbytes( g, &g->r, buf, (int) m );
+    g->left -= m;
+    buf     += m;
+    n       -= m;
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Put up to "*nlines" of the next lines of the stream, LFs included,
+ * in the "size" bytes at "buf".  Stops early when a line might not
+ * fit, so "size" must be at least opts.lines (times the longest
+ * token with a dictionary).  Sets "*nlines" to the number of lines
+ * made and returns the number of bytes, or 0 with errno EINVAL if
+ * the stream is not made of lines.
+ */
+size_t fuzzgen_lines( struct fuzzgen *g, char *buf, size_t size,
+                      long long *nlines ) {
+  if( !g->opts.lines ) {
+    *nlines = 0;
+    errno   = EINVAL;
+    return( 0 );
+  }
+
+  return( fuzzgen_units(g, buf, size, nlines) );
+}
+
+
+/*
+ * Put up to "*nunits" of the next units of the stream, bytes, tokens
+ * or lines, in the "size" bytes at "buf", stopping early when a unit
+ * might not fit.  Sets "*nunits" to the number of units made and
+ * returns the number of bytes.
+ */
+size_t fuzzgen_units( struct fuzzgen *g, char *buf, size_t size,
+                      long long *nunits ) {
+  long long i = 0, k;
+  size_t    n = 0;
+  int       l;
+
+
+  while( i < *nunits ) {
+    if( g->left == 0 ) {
+      nextunits( g );
+    }
+
+    if( g->opts.lines ) {
+      if( size - n < (size_t) g->opts.lines * g->unit + g->opts.headlen +
+                     g->opts.taillen ) {
+        break;
+      }
+
+      l = (int) xbelow(&g->r, g->opts.lines);	/* Line length  */
+
+      n += putline( g, &g->r, buf + n, l );
+      g->left--;
+      i++;
+      continue;
+    }
+
+    k = (long long) ((size - n) / g->unit);
+
+    if( k > *nunits - i ) {
+      k = *nunits - i;
+    }
+
+    if( k > g->left ) {
+      k = g->left;
+    }
+
+    if( k == 0 ) {
+      break;
+    }
+
+    n       += fillunits( g, &g->r, buf + n, (int) k );
+    g->left -= k;
+    i       += k;
+  }
+
+  *nunits = i;
+
+  return( n );
+}
+
+
+/*
+ * Number of units in a full chunk: as many as fit in FUZZGEN_CHUNK
+ * bytes at their longest
+ */
+long long fuzzgen_chunkunits( struct fuzzgen *g ) {
+  long long u = unitbytes( g );
+
+
+  return( FUZZGEN_CHUNK / u > 0 ? FUZZGEN_CHUNK / u : 1 );
+}
+
+
+/*
+ * Size of a buffer that holds any chunk 
+ */
+size_t fuzzgen_chunkbytes( struct fuzzgen *g ) {
+  long long u = unitbytes( g );
+
+
+  return( u > FUZZGEN_CHUNK ? (size_t) u : FUZZGEN_CHUNK );
+}
+
+
+/*
+ * Most bytes in a unit.  Lines are at most "lines" units including
+ * the LF, each at most "unit" bytes, plus the head and the tail.
+ */
+static long long unitbytes( struct fuzzgen *g ) {
+  if( !g->opts.lines ) {
+    return( g->unit );
+  }
+
+  return( (long long) g->unit * g->opts.lines + g->opts.headlen + g->opts.taillen );
+}
+
+
+/*
+ * Set "cur" so that the next fuzzgen_nextchunk() gives the state of
+ * chunk "k".  Philox gets there at once, xoshiro by k jumps.
+ */
+void fuzzgen_seekchunk( struct fuzzgen *g, struct fuzzgen_rng *cur, long long k ) {
+  *cur = g->seed;
+
+  if( cur->kind == FUZZGEN_XOSHIRO ) {
+    while( k-- > 0 ) {
+      xjump( cur );
+    }
+  }
+}
+
+
+/*
+ * Put the state of chunk "k" in "r" and advance "cur" past it.  All
+ * that matters of "g" is already in "cur".
+ */
+void fuzzgen_nextchunk( struct fuzzgen *g, struct fuzzgen_rng *cur,
+                        struct fuzzgen_rng *r, long long k ) {
+  (void) g;
+
+  if( cur->kind == FUZZGEN_PHILOX ) {
+    r->s[0] = cur->s[0];
+    r->s[1] = 0;
+    r->s[2] = (uint64_t) k;
+  }
+  else {
+    xjump( cur );
+    memcpy( r->s, cur->s, sizeof(r->s) );
+  }
+
+  r->kind   = cur->kind;
+  r->nspare = 0;
+  r->lpos   = FUZZGEN_LANES;
+  r->gap    = -1;
+}
+
+
+/*
+ * Generate units "lo" to "hi" - 1 of a chunk into "buf", from "r",
+ * which must hold the state of the chunk.  Units before "lo" are
+ * generated and dropped.  Returns the number of bytes generated.
+ */
+int fuzzgen_genchunk( struct fuzzgen *g, struct fuzzgen_rng *r,
+                      long long lo, long long hi, char *buf ) {
+  long long i;
+  int       n, l;
+
+
+  dropunits( g, r, lo );
+
+  if( !g->opts.lines ) {
+    return( fillunits(g, r, buf, (int) (hi - lo)) );
+  }
+
+  for( n = 0, i = lo ; i < hi ; i++ ) {
+    l = (int) xbelow(r, g->opts.lines);	/* Line length  */
+
+    n += putline( g, r, buf + n, l );
+  }
+
+  return( n );
+}
+
+
+/*
+ * Put a line of "l" units, its LF, and the head and tail if any, at
+ * "p".  Returns the number of bytes.
+ */
+static int putline( struct fuzzgen *g, struct fuzzgen_rng *r, char *p, int l ) {
+  int n = g->opts.headlen;
+
+
+  memcpy( p, g->opts.head, n );
+  n += fillunits( g, r, p + n, l );
+  p[n++] = '\n';
+  memcpy( p + n, g->opts.tail, g->opts.taillen );
+
+  return( n + g->opts.taillen );
+}
+
+
+/*
+ * Generate "n" bytes (or tokens) from "r" and throw them away 
+ */
+static void dropbytes( struct fuzzgen *g, struct fuzzgen_rng *r, long long n ) {
+  char buf[4096];
+  int  m, per = (int) sizeof(buf) / g->unit;
+
+
+  for( ; n > 0 ; n -= m ) {
+    m = n < per ? (int) n : per;
+    fillunits( g, r, buf, m );
+  }
+}
+
+
+/*
+ * Generate "n" units, bytes or lines, from "r" and throw them away 
+ */
+static void dropunits( struct fuzzgen *g, struct fuzzgen_rng *r, long long n ) {
+  if( !g->opts.lines ) {
+    dropbytes( g, r, n );
+    return;
+  }
+
+  while( n-- > 0 ) {
+    dropbytes( g, r, (long long) xbelow(r, g->opts.lines) );
+  }
+}
+
+
+/*
+ * Seed xoshiro256** from a single number, expanding it with
+ * splitmix64 as recommended by the xoshiro authors.  Throws away
+ * any lanes left over from a previous seed.
+ */
+static void xseed( struct fuzzgen_rng *r, uint64_t s ) {
+  uint64_t z;
+  int      i;
+
+
+  for( i = 0 ; i < 4 ; i++ ) {
+    z = (s += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    r->s[i] = z ^ (z >> 31);
+  }
+
+  r->kind   = FUZZGEN_XOSHIRO;
+  r->nspare = 0;
+  r->lpos   = FUZZGEN_LANES;
+}
+
+
+/*
+ * Next 64 random bits from xoshiro256** (or Philox)
+ */
+#define ROTL(x, k) (((x) << (k)) | ((x) >> (64 - (k))))
+
+static uint64_t xnext( struct fuzzgen_rng *r ) {
+  uint64_t *s = r->s;
+  uint64_t  v, t;
+
+
+  if( r->kind == FUZZGEN_PHILOX ) {
+    return( pnext(r) );
+  }
+
+  v = ROTL(s[1] * 5, 7) * 9;
+  t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3]  = ROTL(s[3], 45);
+
+  return( v );
+}
+
+
+/*
+ * Advance "r" by 2^128 draws, giving a stream that does not
+ * overlap with the one before.
+ */
+static void xjump( struct fuzzgen_rng *r ) {
+  static const uint64_t jump[4] = {
+    0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+    0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+  };
+  uint64_t s[4] = { 0, 0, 0, 0 };
+  int      i, b;
+
+
+  for( i = 0 ; i < 4 ; i++ ) {
+    for( b = 0 ; b < 64 ; b++ ) {
+      if( jump[i] & (1ULL << b) ) {
+        s[0] ^= r->s[0];
+        s[1] ^= r->s[1];
+        s[2] ^= r->s[2];
+        s[3] ^= r->s[3];
+      }
+
+      (void) xnext( r );
+    }
+  }
+
+  memcpy( r->s, s, sizeof(s) );
+}
+
+
+/*
+ * Seed Philox4x32-10.  The key is the splitmix64 mix of the seed;
+ * the state is set up for the draws before chunk 0, with the chunk
+ * number all ones.
+ */
+static void pseed( struct fuzzgen_rng *r, uint64_t s ) {
+  uint64_t z;
+
+
+  z = s + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  r->kind   = FUZZGEN_PHILOX;
+  r->s[0]   = z ^ (z >> 31);
+  r->s[1]   = 0;
+  r->s[2]   = ~(uint64_t) 0;
+  r->s[3]   = 0;
+  r->nspare = 0;
+  r->lpos   = FUZZGEN_LANES;
+}
+
+
+/*
+ * Next 64 random bits from Philox4x32-10: block s[1] of chunk s[2]
+ * gives two words.  Any block can be had without the ones before.
+ */
+static uint64_t pnext( struct fuzzgen_rng *r ) {
+  uint32_t c[4], k[2], h0, h1, l0, l1;
+  uint64_t p;
+  int      i;
+
+
+  if( r->nspare ) {
+    r->nspare = 0;
+    return( r->spare );
+  }
+
+  c[0] = (uint32_t) r->s[1];
+  c[1] = (uint32_t) (r->s[1] >> 32);
+  c[2] = (uint32_t) r->s[2];
+  c[3] = (uint32_t) (r->s[2] >> 32);
+  k[0] = (uint32_t) r->s[0];
+  k[1] = (uint32_t) (r->s[0] >> 32);
+
+  for( i = 0 ; i < 10 ; i++ ) {
+    p  = (uint64_t) 0xd2511f53 * c[0];
+    h0 = (uint32_t) (p >> 32);
+    l0 = (uint32_t) p;
+    p  = (uint64_t) 0xcd9e8d57 * c[2];
+    h1 = (uint32_t) (p >> 32);
+    l1 = (uint32_t) p;
+
+    c[0] = h1 ^ c[1] ^ k[0];
+    c[1] = l1;
+    c[2] = h0 ^ c[3] ^ k[1];
+    c[3] = l0;
+
+    k[0] += 0x9e3779b9;
+    k[1] += 0xbb67ae85;
+  }
+
+  r->s[1]++;
+  r->spare  = (uint64_t) c[2] | (uint64_t) c[3] << 32;
+  r->nspare = 1;
+
+  return( (uint64_t) c[0] | (uint64_t) c[1] << 32 );
+}
+
+
+/*
+ * Unbiased random number in [0, n), n > 0, by Lemire's multiply
+ * and reject method: one multiplication, almost never a division.
+ */
+static uint64_t xbelow( struct fuzzgen_rng *r, uint64_t n ) {
+  __uint128_t p;
+  uint64_t    t;
+
+
+  p = (__uint128_t) xnext(r) * n;
+
+  if( (uint64_t) p < n ) {
+    t = -n % n;
+
+    while( (uint64_t) p < t ) {
+      p = (__uint128_t) xnext(r) * n;
+    }
+  }
+
+  return( (uint64_t) (p >> 64) );
+}
+
+
+/*
+ * Set up the byte mapping for fillbytes(): each random 16-bit lane x
+ * gives the byte (x * m >> 16) + h, unless the low half of x * m is
+ * below 2^16 mod m, in which case the lane is dropped.  This is
+ * Lemire's method on 16 bits and keeps every byte exactly uniform.
+ * The bytes are 1-255 by default, 0-255 with NULs, and 32-126 when
+ * printable, with 127 standing for NUL if asked for.
+ */
+static void setmap( struct fuzzgen *g ) {
+  int h = 1;
+  int m = 255;
+
+
+  if( g->opts.nul ) {
+    h = 0;
+    m = 256;
+  }
+
+  if( !g->opts.all ) {
+    h = 32;
+    m = 95 + (g->opts.nul != 0);
+  }
+
+  g->mapm   = m;
+  g->maph   = h;
+  g->mapthr = 65536 % m;
+  g->mapnul = (g->opts.nul && !g->opts.all) ? 127 : 256;
+}
+
+
+/*
+ * Fill "p" with "n" random bytes as set up by setmap().  Every 64-bit
+ * draw yields four lanes, i.e. up to four bytes.  Runs of accepted
+ * lanes are mapped by "mapkern"; the lane-at-a-time loop below steps
+ * over rejected lanes and the tail, so the output does not depend on
+ * which kernel is in use.
+ */
+static void fillbytes( struct fuzzgen *g, struct fuzzgen_rng *r, char *p, int n ) {
+  uint64_t w;
+  uint32_t x;
+  unsigned c;
+  int      i, k;
+
+
+  if( g->weighted ) {
+    fillalias( g, r, p, n );
+    return;
+  }
+
+  while( n > 0 ) {
+    if( r->lpos == FUZZGEN_LANES ) {
+      for( i = 0 ; i < FUZZGEN_LANES ; i += 4 ) {
+        w = xnext( r );
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy( r->lanes + i, &w, sizeof(w) );
+#else
+        r->lanes[i]     = (uint16_t) w;
+        r->lanes[i + 1] = (uint16_t) (w >> 16);
+        r->lanes[i + 2] = (uint16_t) (w >> 32);
+        r->lanes[i + 3] = (uint16_t) (w >> 48);
+#endif
+      }
+
+      r->lpos = 0;
+    }
+
+    k = (*mapkern)( g, r->lanes + r->lpos, FUZZGEN_LANES - r->lpos, p, n );
+    r->lpos += k;
+    p       += k;
+    n       -= k;
+
+    if( n == 0 || r->lpos == FUZZGEN_LANES ) {
+      continue;
+    }
+
+    x = (uint32_t) r->lanes[r->lpos++] * g->mapm;
+
+    if( (x & 0xffff) < g->mapthr ) {
+      continue;
+    }
+
+    c = (x >> 16) + g->maph;
+
+    *p++ = (char) (c == g->mapnul ? 0 : c);
+    n--;
+  }
+}
+
+
+/*
+ * The kernels map a run of "nx" lanes at "x" to at most "n" bytes at
+ * "p", a whole vector at a time and without branching on the data.
+ * They stop short of the first vector holding a rejected lane and
+ * return the number of lanes (= bytes) done.  The scalar kernel
+ * leaves everything to fillbytes().
+ */
+static int map_scalar( const struct fuzzgen *g, const uint16_t *x, int nx,
+                       char *p, int n ) {
+  (void) g;
+  (void) x;
+  (void) nx;
+  (void) p;
+  (void) n;
+
+  return( 0 );
+}
+
+
+#ifdef X86
+__attribute__((target("sse2")))
+static int map_sse2( const struct fuzzgen *g, const uint16_t *x, int nx,
+                     char *p, int n ) {
+  __m128i vm, vh, vt, vn, vz, a, b, ra, rb, r;
+  int     i;
+
+
+  vm = _mm_set1_epi16( (short) g->mapm );
+  vh = _mm_set1_epi16( (short) g->maph );
+  vt = _mm_set1_epi16( (short) g->mapthr );
+  vn = _mm_set1_epi8( (char) g->mapnul );
+  vz = _mm_setzero_si128();
+
+  for( i = 0 ; i + 16 <= nx && i + 16 <= n ; i += 16 ) {
+    a  = _mm_loadu_si128( (const __m128i *) (x + i) );
+    b  = _mm_loadu_si128( (const __m128i *) (x + i + 8) );
+
+    /* Lane rejected if its low product is below the threshold */
+    r  = _mm_or_si128( _mm_subs_epu16(vt, _mm_mullo_epi16(a, vm)),
+                       _mm_subs_epu16(vt, _mm_mullo_epi16(b, vm)) );
+
+    if( _mm_movemask_epi8(_mm_cmpeq_epi16(r, vz)) != 0xffff ) {
+      break;
+    }
+
+    ra = _mm_add_epi16( _mm_mulhi_epu16(a, vm), vh );
+    rb = _mm_add_epi16( _mm_mulhi_epu16(b, vm), vh );
+    r  = _mm_packus_epi16( ra, rb );
+
+    if( g->mapnul != 256 ) {
+      r = _mm_andnot_si128( _mm_cmpeq_epi8(r, vn), r );
+    }
+
+    _mm_storeu_si128( (__m128i *) (p + i), r );
+  }
+
+  return( i );
+}
+
+
+__attribute__((target("avx2")))
+static int map_avx2( const struct fuzzgen *g, const uint16_t *x, int nx,
+                     char *p, int n ) {
+  __m256i vm, vh, vt, vn, vz, a, b, ra, rb, r;
+  int     i;
+
+
+  vm = _mm256_set1_epi16( (short) g->mapm );
+  vh = _mm256_set1_epi16( (short) g->maph );
+  vt = _mm256_set1_epi16( (short) g->mapthr );
+  vn = _mm256_set1_epi8( (char) g->mapnul );
+  vz = _mm256_setzero_si256();
+
+  for( i = 0 ; i + 32 <= nx && i + 32 <= n ; i += 32 ) {
+    a  = _mm256_loadu_si256( (const __m256i *) (x + i) );
+    b  = _mm256_loadu_si256( (const __m256i *) (x + i + 16) );
+
+    r  = _mm256_or_si256( _mm256_subs_epu16(vt, _mm256_mullo_epi16(a, vm)),
+                          _mm256_subs_epu16(vt, _mm256_mullo_epi16(b, vm)) );
+
+    if( (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi16(r, vz))
+        != 0xffffffffU ) {
+      break;
+    }
+
+    ra = _mm256_add_epi16( _mm256_mulhi_epu16(a, vm), vh );
+    rb = _mm256_add_epi16( _mm256_mulhi_epu16(b, vm), vh );
+
+    /* packus works within 128-bit halves; put the quarters back in order */
+    r  = _mm256_permute4x64_epi64( _mm256_packus_epi16(ra, rb), 0xd8 );
+
+    if( g->mapnul != 256 ) {
+      r = _mm256_andnot_si256( _mm256_cmpeq_epi8(r, vn), r );
+    }
+
+    _mm256_storeu_si256( (__m256i *) (p + i), r );
+  }
+
+  return( i );
+}
+
+
+__attribute__((target("avx512bw,avx2")))
+static int map_avx512( const struct fuzzgen *g, const uint16_t *x, int nx,
+                       char *p, int n ) {
+  __m512i vm, vh, vt, a;
+  __m256i vn, r;
+  int     i;
+
+
+  vm = _mm512_set1_epi16( (short) g->mapm );
+  vh = _mm512_set1_epi16( (short) g->maph );
+  vt = _mm512_set1_epi16( (short) g->mapthr );
+  vn = _mm256_set1_epi8( (char) g->mapnul );
+
+  for( i = 0 ; i + 32 <= nx && i + 32 <= n ; i += 32 ) {
+    a = _mm512_loadu_si512( (const void *) (x + i) );
+
+    if( _mm512_cmplt_epu16_mask(_mm512_mullo_epi16(a, vm), vt) != 0 ) {
+      break;
+    }
+
+    r = _mm512_cvtepi16_epi8( _mm512_add_epi16(_mm512_mulhi_epu16(a, vm), vh) );
+
+    if( g->mapnul != 256 ) {
+      r = _mm256_andnot_si256( _mm256_cmpeq_epi8(r, vn), r );
+    }
+
+    _mm256_storeu_si256( (__m256i *) (p + i), r );
+  }
+
+  return( i );
+}
+#endif
+
+
+/*
+ * Build Vose's alias table for the "n" weights at "w": column i gives
+ * i when a uniform 24-bit number is below thr[i], else alias[i].
+ * Each column holds 1/n of the total weight, so a draw costs one
+ * column pick, one compare and one lookup whatever the weights.
+ * Returns -1 with errno EINVAL if no weight is positive.
+ */
+int fuzzgen_alias( const double *w, int n, uint32_t *thr, uint32_t *alias ) {
+  double *p, sum = 0;
+  int    *small, *large, ns = 0, nl = 0, i, s, l;
+
+
+  for( i = 0 ; i < n ; i++ ) {
+    if( !(w[i] >= 0) ) {
+      errno = EINVAL;
+      return( -1 );
+    }
+
+    sum += w[i];
+  }
+
+  if( !(sum > 0) ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  p     = (double *) malloc( n * sizeof(double) );
+  small = (int *) malloc( n * sizeof(int) );
+  large = (int *) malloc( n * sizeof(int) );
+
+  if( p == NULL || small == NULL || large == NULL ) {
+    free( p );
+    free( small );
+    free( large );
+    return( -1 );
+  }
+
+  for( i = 0 ; i < n ; i++ ) {
+    p[i] = w[i] * n / sum;
+
+    if( p[i] < 1 ) {
+      small[ns++] = i;
+    }
+    else {
+      large[nl++] = i;
+    }
+  }
+
+  /* Top up each short column from a long one */
+  while( ns > 0 && nl > 0 ) {
+    s = small[--ns];
+    l = large[--nl];
+
+    thr[s]   = (uint32_t) (p[s] * (1 << 24) + 0.5);
+    alias[s] = l;
+    p[l]     = (p[l] + p[s]) - 1;
+
+    if( p[l] < 1 ) {
+      small[ns++] = l;
+    }
+    else {
+      large[nl++] = l;
+    }
+  }
+
+  /* What is left is full, up to rounding */
+  while( nl > 0 ) {
+    l        = large[--nl];
+    thr[l]   = 1 << 24;
+    alias[l] = l;
+  }
+
+  while( ns > 0 ) {
+    s        = small[--ns];
+    thr[s]   = 1 << 24;
+    alias[s] = s;
+  }
+
+  free( p );
+  free( small );
+  free( large );
+
+  return( 0 );
+}
+
+
+/*
+ * Alias table of the byte weights "w", packed for fillalias(): a
+ * full column is one whose alias is itself.
+ */
+static int setalias( struct fuzzgen *g, const double *w ) {
+  uint32_t thr[256], alias[256];
+  int      i;
+
+
+  if( fuzzgen_alias(w, 256, thr, alias) < 0 ) {
+    return( -1 );
+  }
+
+  for( i = 0 ; i < 256 ; i++ ) {
+    if( thr[i] >= (1 << 24) ) {
+      g->alias[i] = (uint32_t) i;
+    }
+    else {
+      g->alias[i] = thr[i] << 8 | alias[i];
+    }
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Fill "p" with "n" weighted bytes.  Every 64-bit draw yields two
+ * 32-bit lanes: the top 8 bits of a lane pick the column, the low
+ * 24 are compared with its threshold.  No lane is ever rejected.
+ */
+static void fillalias( struct fuzzgen *g, struct fuzzgen_rng *r, char *p, int n ) {
+  uint64_t w;
+  int      i, k;
+
+
+  while( n > 0 ) {
+    if( r->lpos >= FUZZGEN_LANES / 2 ) {
+      for( i = 0 ; i < FUZZGEN_LANES / 2 ; i += 2 ) {
+        w = xnext( r );
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy( r->wide + i, &w, sizeof(w) );
+#else
+        r->wide[i]     = (uint32_t) w;
+        r->wide[i + 1] = (uint32_t) (w >> 32);
+#endif
+      }
+
+      r->lpos = 0;
+    }
+
+    k = FUZZGEN_LANES / 2 - r->lpos;
+
+    if( k > n ) {
+      k = n;
+    }
+
+    (*aliaskern)( g, r->wide + r->lpos, p, k );
+    r->lpos += k;
+    p       += k;
+    n       -= k;
+  }
+}
+
+
+static void alias_scalar( const struct fuzzgen *g, const uint32_t *x,
+                          char *p, int n ) {
+  uint32_t e;
+  int      i;
+
+
+  for( i = 0 ; i < n ; i++ ) {
+    e    = g->alias[x[i] >> 24];
+    p[i] = (char) ((x[i] & 0xffffff) < (e >> 8) ? x[i] >> 24 : e & 0xff);
+  }
+}
+
+
+#ifdef X86
+/*
+ * Eight lanes at a time, the columns fetched with one gather
+ */
+__attribute__((target("avx2")))
+static void alias_avx2( const struct fuzzgen *g, const uint32_t *x,
+                        char *p, int n ) {
+  __m256i lo, lob, pick, v, col, e, keep, b;
+  int     i;
+
+
+  lo   = _mm256_set1_epi32( 0xffffff );
+  lob  = _mm256_set1_epi32( 0xff );
+  pick = _mm256_setr_epi8( 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                           0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 );
+
+  for( i = 0 ; i + 8 <= n ; i += 8 ) {
+    v    = _mm256_loadu_si256( (const __m256i *) (x + i) );
+    col  = _mm256_srli_epi32( v, 24 );
+    e    = _mm256_i32gather_epi32( (const int *) g->alias, col, 4 );
+
+    /* Both sides are below 2^24, so the signed compare will do */
+    keep = _mm256_cmpgt_epi32( _mm256_srli_epi32(e, 8), _mm256_and_si256(v, lo) );
+    b    = _mm256_blendv_epi8( _mm256_and_si256(e, lob), col, keep );
+
+    /* Low byte of each lane, then the two halves side by side */
+    b    = _mm256_shuffle_epi8( b, pick );
+    b    = _mm256_permutevar8x32_epi32( b, _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1) );
+    _mm_storel_epi64( (__m128i *) (p + i), _mm256_castsi256_si128(b) );
+  }
+
+  alias_scalar( g, x + i, p + i, n - i );
+}
+#endif
+
+
+/*
+ * Add the "len" bytes at "tok" to the dictionary with weight "w".
+ * Tokens are copied to the end of the arena, which grows as needed.
+ * Returns -1 with errno set on failure, EINVAL for an empty or too
+ * long token or a bad weight.
+ */
+int fuzzgen_dict_add( struct fuzzgen_dict *d, const char *tok, size_t len,
+                      double w ) {
+  char     *a;
+  uint32_t *off, *ln;
+  double   *wt;
+  size_t    size;
+
+
+  if( len == 0 || len > FUZZGEN_TOKMAX || !(w >= 0) ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  if( d->alen + len > d->asize ) {
+    size = d->asize > 0 ? d->asize : 4096;
+
+    while( d->alen + len > size ) {
+      size *= 2;
+    }
+
+    if( (a = (char *) realloc(d->arena, size)) == NULL ) {
+      return( -1 );
+    }
+
+    d->arena = a;
+    d->asize = size;
+  }
+
+  if( d->n == d->max ) {
+    off = (uint32_t *) realloc( d->off, (d->max + 256) * sizeof(uint32_t) );
+    if( off != NULL ) {
+      d->off = off;
+    }
+
+    ln = (uint32_t *) realloc( d->len, (d->max + 256) * sizeof(uint32_t) );
+    if( ln != NULL ) {
+      d->len = ln;
+    }
+
+    wt = (double *) realloc( d->w, (d->max + 256) * sizeof(double) );
+    if( wt != NULL ) {
+      d->w = wt;
+    }
+
+    if( off == NULL || ln == NULL || wt == NULL ) {
+      return( -1 );
+    }
+
+    d->max += 256;
+  }
+
+  memcpy( d->arena + d->alen, tok, len );
+  d->off[d->n] = (uint32_t) d->alen;
+  d->len[d->n] = (uint32_t) len;
+  d->w[d->n]   = w;
+  d->alen     += len;
+  d->n++;
+
+  if( (int) len > d->maxlen ) {
+    d->maxlen = (int) len;
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Make the alias table of the token weights, once all tokens are in.
+ * Returns -1 with errno EINVAL if there are no tokens or no weight is
+ * positive.
+ */
+int fuzzgen_dict_build( struct fuzzgen_dict *d ) {
+  if( d->n == 0 ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  free( d->thr );
+  free( d->alias );
+
+  d->thr   = (uint32_t *) malloc( d->n * sizeof(uint32_t) );
+  d->alias = (uint32_t *) malloc( d->n * sizeof(uint32_t) );
+
+  if( d->thr == NULL || d->alias == NULL ||
+      fuzzgen_alias(d->w, d->n, d->thr, d->alias) < 0 ) {
+    free( d->thr );
+    free( d->alias );
+    d->thr = d->alias = NULL;
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+void fuzzgen_dict_free( struct fuzzgen_dict *d ) {
+  free( d->arena );
+  free( d->off );
+  free( d->len );
+  free( d->w );
+  free( d->thr );
+  free( d->alias );
+  memset( d, 0, sizeof(*d) );
+}
+
+
+/*
+ * A token of "d" drawn with its weight, for callers that place
+ * tokens themselves.  It moves the stream on.
+ */
+int fuzzgen_dict_pick( struct fuzzgen *g, const struct fuzzgen_dict *d ) {
+  return( picktoken(d, &g->r) );
+}
+
+
+/*
+ * Draw a token from the alias table: the high half of one 64-bit
+ * draw picks the column, the low 24 bits are compared with its
+ * threshold.
+ */
+static int picktoken( const struct fuzzgen_dict *d, struct fuzzgen_rng *r ) {
+  uint64_t x = xnext( r );
+  uint32_t t;
+
+
+  t = (uint32_t) (((x >> 32) * (uint64_t) d->n) >> 32);
+
+  if( (x & 0xffffff) >= d->thr[t] ) {
+    t = d->alias[t];
+  }
+
+  return( (int) t );
+}
+
+
+/*
+ * Fill "p" with "n" units and return the number of bytes.  Without a
+ * dictionary a unit is a byte.  With one, each gap of bytes is drawn
+ * once and made by fillbytes() in one go, and each token is copied
+ * whole from the arena.  The gap left over is kept in "r", so the
+ * units do not depend on how a run of them is split into calls.
+ */
+static int fillunits( struct fuzzgen *g, struct fuzzgen_rng *r, char *p, int n ) {
+  const struct fuzzgen_dict *d = g->dict;
+  int                        b = 0, k, t;
+
+
+  if( d == NULL ) {
+    fillbytes( g, r, p, n );
+    return( n );
+  }
+
+  while( n > 0 ) {
+    if( r->gap < 0 ) {
+      r->gap = (long long) xbelow( r, g->gapmax );
+    }
+
+    k = r->gap < n ? (int) r->gap : n;
+
+    fillbytes( g, r, p + b, k );
+    b      += k;
+    n      -= k;
+    r->gap -= k;
+
+    if( n == 0 ) {
+      break;
+    }
+
+    t = picktoken( d, r );
+    memcpy( p + b, d->arena + d->off[t], d->len[t] );
+    b += d->len[t];
+    n--;
+    r->gap = -1;
+  }
+
+  return( b );
+}
+
+
+/*
+ * Pick the widest kernel the CPU supports, unless FUZZ_KERNEL in the
+ * environment names one that it has
+ */
+static void pickkernel( void ) {
+  char *force = getenv("FUZZ_KERNEL");
+
+
+  if( force != NULL && usekernel(force) == 0 ) {
+    return;
+  }
+
+#ifdef X86
+  __builtin_cpu_init();
+
+  if( __builtin_cpu_supports("avx512bw") ) {
+    mapkern   = map_avx512;
+    aliaskern = alias_avx2;
+    kernname  = "avx512";
+  }
+  else if( __builtin_cpu_supports("avx2") ) {
+    mapkern   = map_avx2;
+    aliaskern = alias_avx2;
+    kernname  = "avx2";
+  }
+  else if( __builtin_cpu_supports("sse2") ) {
+    mapkern  = map_sse2;
+    kernname = "sse2";
+  }
+#endif
+}
+
+
+/*
+ * Use kernel "name" ("scalar", "sse2", "avx2" or "avx512") for all
+ * generators of the process.  The output is the same with any of
+ * them.  Returns -1 with errno ENOTSUP if the CPU does not have it.
+ */
+int fuzzgen_kernel( const char *name ) {
+  pthread_once( &kernonce, pickkernel );
+
+  return( usekernel(name) );
+}
+
+
+static int usekernel( const char *name ) {
+  if( strcmp(name, "scalar") == 0 ) {
+    mapkern   = map_scalar;
+    aliaskern = alias_scalar;
+    kernname  = "scalar";
+    return( 0 );
+  }
+
+#ifdef X86
+  __builtin_cpu_init();
+
+  if( strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512bw") ) {
+    mapkern   = map_avx512;
+    aliaskern = alias_avx2;
+    kernname  = "avx512";
+    return( 0 );
+  }
+
+  if( strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") ) {
+    mapkern   = map_avx2;
+    aliaskern = alias_avx2;
+    kernname  = "avx2";
+    return( 0 );
+  }
+
+  if( strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2") ) {
+    mapkern   = map_sse2;
+    aliaskern = alias_scalar;
+    kernname  = "sse2";
+    return( 0 );
+  }
+#endif
+
+  errno = ENOTSUP;
+  return( -1 );
+}
+
+
+/*
+ * Name of the kernel in use 
+ */
+const char *fuzzgen_kernname( void ) {
+  pthread_once( &kernonce, pickkernel );
+
+  return( kernname );
+}
@@ -0,0 +1,143 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  libfuzzgen -- the random stream generator of fuzz, in process
+ *
+ *  A generator is made from options and a 64-bit seed:
+ *
+ *      struct fuzzgen_opts o = { FUZZGEN_XOSHIRO, 0, 1, 0 };
+ *      struct fuzzgen     *g = fuzzgen_init(&o, seed);
+ *
+ *      fuzzgen_fill(g, buf, n);            next n bytes of the stream
+ *      fuzzgen_lines(g, buf, size, &n);    next lines, with o.lines
+ *      fuzzgen_units(g, buf, size, &n);    next bytes, tokens or lines
+ *      fuzzgen_free(g);
+ *
+ *  and gives the same stream as "fuzz -s seed" with the same options.
+ *  With opts.weights, bytes are drawn with those weights instead (see
+ *  fuzz -w) from an alias table: one 32-bit lane and one lookup each.
+ *  With opts.dict, tokens of the dictionary take the place of about
+ *  a fraction opts.dictp of the bytes (see fuzz -D); the stream is
+ *  then one of units, each a byte or a whole token, and is read with
+ *  fuzzgen_units() or fuzzgen_lines().  With opts.head and opts.tail,
+ *  every line, LF included, is put between those bytes.
+ *  All state is in the generator, so any number of them can be used
+ *  at once, one per thread.  The libc rand() streams of "fuzz -g rand"
+ *  are not available here.
+ *
+ *  The stream is made of chunks of FUZZGEN_CHUNK bytes (or of as many
+ *  lines or tokens as fit in that), each from its own generator state, so
+ *  that any part of it can be made on its own.  The chunk calls below
+ *  give that access; they only read the generator, and can be used by
+ *  several threads on the same one.
+ */
+
+#ifndef FUZZGEN_H
+#define FUZZGEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FUZZGEN_XOSHIRO 1       /* xoshiro256**, same on every host */
+#define FUZZGEN_PHILOX  2       /* Philox4x32-10, counter based */
+
+#define FUZZGEN_LANES   1024    /* 16-bit random lanes drawn at a time */
+#define FUZZGEN_CHUNK   (1 << 20)
+#define FUZZGEN_TOKMAX  256     /* Longest dictionary token */
+
+/*
+ * A dictionary: the tokens end to end in one arena, token i being
+ * the len[i] bytes at arena + off[i], and once built an alias table
+ * of their weights (see fuzzgen_alias()).  It is only read by the
+ * generators that use it, and must outlive them.
+ */
+struct fuzzgen_dict {
+  char     *arena;
+  size_t    alen, asize;
+  uint32_t *off, *len;
+  double   *w;
+  uint32_t *thr, *alias;
+  int       n, max;             /* Tokens, room for tokens */
+  int       maxlen;             /* Longest token */
+};
+
+struct fuzzgen_opts {
+  int gen;                      /* FUZZGEN_XOSHIRO or FUZZGEN_PHILOX */
+  int nul;                      /* Include NUL bytes (fuzz -0) */
+  int all;                      /* All bytes, else printable (fuzz -a, -p) */
+  int lines;                    /* Lines of up to this many bytes (fuzz -l) */
+  const double *weights;        /* Weights of bytes 0-255, or NULL */
+  const struct fuzzgen_dict *dict; /* Tokens to mix in, or NULL ... */
+  double dictp;                 /* ... as about this fraction of units */
+  const char *head, *tail;      /* With lines, bytes put before and ... */
+  int headlen, taillen;         /* ... after each of them (fuzz -L) */
+};
+
+/*
+ * A generator state, with the lanes drawn but not yet used.  For
+ * Philox, s[0] is the key, s[1] the block and s[2] the chunk number.
+ */
+struct fuzzgen_rng {
+  int      kind;
+  uint64_t s[4];
+  uint64_t spare;               /* Philox: second word of the last block */
+  int      nspare;
+  union {
+    uint16_t lanes[FUZZGEN_LANES];
+    uint32_t wide[FUZZGEN_LANES / 2]; /* 32-bit lanes of weighted bytes */
+  };
+  int      lpos;
+  long long gap;                /* Units before the next token, -1 undrawn */
+};
+
+struct fuzzgen {
+  struct fuzzgen_opts opts;
+  struct fuzzgen_rng  seed;     /* State right after seeding */
+  unsigned            mapm, maph; /* Bytes are mapm values from maph on */
+  unsigned            mapthr;   /* Lanes with low product < mapthr rejected */
+  unsigned            mapnul;   /* Byte value sent as NUL, or 256 for none */
+  int                 weighted; /* Bytes from "alias", not the mapping */
+  uint32_t            alias[256]; /* Column threshold << 8 | alias byte */
+  const struct fuzzgen_dict *dict;
+  uint64_t            gapmax;   /* Gaps between tokens are below this */
+  int                 unit;     /* Most bytes in a unit */
+  struct fuzzgen_rng  cur, r;   /* Where fuzzgen_fill() and ... */
+  long long           k, left;  /* ... fuzzgen_lines() are: chunk, units left */
+};
+
+struct fuzzgen *fuzzgen_init(const struct fuzzgen_opts *o, uint64_t seed);
+void      fuzzgen_free(struct fuzzgen *g);
+long long fuzzgen_drawlength(struct fuzzgen *g, long long n);
+void      fuzzgen_seek(struct fuzzgen *g, long long unit);
+int       fuzzgen_fill(struct fuzzgen *g, char *buf, size_t n);
+size_t    fuzzgen_lines(struct fuzzgen *g, char *buf, size_t size,
+                        long long *nlines);
+size_t    fuzzgen_units(struct fuzzgen *g, char *buf, size_t size,
+                        long long *nunits);
+uint64_t  fuzzgen_below(struct fuzzgen *g, uint64_t n);
+
+long long fuzzgen_chunkunits(struct fuzzgen *g);
+size_t    fuzzgen_chunkbytes(struct fuzzgen *g);
+void      fuzzgen_seekchunk(struct fuzzgen *g, struct fuzzgen_rng *cur,
+                            long long k);
+void      fuzzgen_nextchunk(struct fuzzgen *g, struct fuzzgen_rng *cur,
+                            struct fuzzgen_rng *r, long long k);
+int       fuzzgen_genchunk(struct fuzzgen *g, struct fuzzgen_rng *r,
+                           long long lo, long long hi, char *buf);
+
+int         fuzzgen_alias(const double *w, int n, uint32_t *thr, uint32_t *alias);
+int         fuzzgen_dict_add(struct fuzzgen_dict *d, const char *tok, size_t len,
+                             double w);
+int         fuzzgen_dict_build(struct fuzzgen_dict *d);
+void        fuzzgen_dict_free(struct fuzzgen_dict *d);
+int         fuzzgen_dict_pick(struct fuzzgen *g, const struct fuzzgen_dict *d);
+int         fuzzgen_kernel(const char *name);
+const char *fuzzgen_kernname(void);
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  fuzzpack -- keep many test cases in one pack file
+ *
+ *  Usage:
+ *
+ *     fuzzpack pack PACK FILE ...        append FILEs as new cases
+ *     fuzzpack list PACK                 list the cases
+ *     fuzzpack extract PACK ID[-ID] DIR  write cases to DIR/ID
+ *
+ *  The cases in a pack can be replayed with "fuzz -r PACK:ID" or
+ *  "fuzz -r PACK:FROM-TO".  The metadata of a case is the name of
+ *  the file it came from, or for cases written by fuzz itself, the
+ *  record of its stream (see fuzz -O).
+ */
+
+static char *progname = "fuzzpack";
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pack.h"
+
+
+void usage();
+void dopack(char *path, char **files);
+void dolist(char *path);
+void doextract(char *path, char *range, char *dir);
+void openpack(struct pack *p, char *path, int writable);
+
+
+int main( int argc, char **argv ) {
+  if( argc >= 4 && strcmp(argv[1], "pack") == 0 ) {
+    dopack( argv[2], argv + 3 );
+  }
+  else if( argc == 3 && strcmp(argv[1], "list") == 0 ) {
+    dolist( argv[2] );
+  }
+  else if( argc == 5 && strcmp(argv[1], "extract") == 0 ) {
+    doextract( argv[2], argv[3], argv[4] );
+  }
+  else {
+    usage();
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Print help screen
+ */
+void usage() {
+  printf("  Usage: \n");
+  printf("    fuzzpack pack PACK FILE ...        append FILEs to PACK as new cases\n");
+  printf("    fuzzpack list PACK                 list the cases in PACK\n");
+  printf("    fuzzpack extract PACK ID[-ID] DIR  write cases to DIR/ID\n\n");
+  printf("  Cases are replayed with \"fuzz -r PACK:ID\" or \"fuzz -r PACK:FROM-TO\"\n\n");
+
+  exit(1);
+}
+
+
+void openpack( struct pack *p, char *path, int writable ) {
+  if( pack_open(p, path, writable) < 0 ) {
+    perror(path);
+    exit(1);
+  }
+}
+
+
+/*
+ * Append "files" to the pack, with their names as metadata
+ */
+void dopack( char *path, char **files ) {
+  struct pack p;
+  struct stat st;
+  uint64_t    id;
+  char       *data;
+  int         fd;
+
+
+  openpack( &p, path, 1 );
+
+  for( ; *files != NULL ; files++ ) {
+    if( (fd = open(*files, O_RDONLY)) < 0 || fstat(fd, &st) < 0 ) {
+      perror(*files);
+      exit(1);
+    }
+
+    data = NULL;
+
+    if( st.st_size > 0 &&
+        (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED ) {
+      perror(*files);
+      exit(1);
+    }
+
+    if( pack_append(&p, data, st.st_size, *files, strlen(*files), &id) < 0 ) {
+      perror(path);
+      exit(1);
+    }
+
+    printf("%llu %s\n", (unsigned long long) id, *files);
+
+    if( data != NULL ) {
+      munmap( data, st.st_size );
+    }
+
+    close( fd );
+  }
+
+  if( pack_commit(&p) < 0 ) {
+    perror(path);
+    exit(1);
+  }
+
+  pack_close( &p );
+}
+
+
+/*
+ * One line per case: id, offset, length, metadata
+ */
+void dolist( char *path ) {
+  struct pack    p;
+  struct packent e;
+  uint64_t       i;
+
+
+  openpack( &p, path, 0 );
+
+  for( i = 0 ; i < p.count ; i++ ) {
+    if( pack_entry(&p, i, &e) < 0 ) {
+      fprintf(stderr, "%s: %s: case %llu is outside the pack\n", progname,
+              path, (unsigned long long) e.id);
+      exit(1);
+    }
+
+    printf("%llu %llu %llu %.*s\n", (unsigned long long) e.id,
+           (unsigned long long) e.off, (unsigned long long) e.len,
+           (int) e.mlen, p.map + e.moff);
+  }
+
+  pack_close( &p );
+}
+
+
+/*
+ * Write the cases in "range" to files named after their ids in "dir"
+ */
+void doextract( char *path, char *range, char *dir ) {
+  struct pack    p;
+  struct packent e;
+  uint64_t       from, to, id;
+  char           name[4096], *spec, *dummy;
+  FILE          *f;
+
+
+  /* Reuse the PATH:ID parser on ":ID" */
+  if( (spec = malloc(strlen(range) + 3)) == NULL ) {
+    perror(progname);
+    exit(1);
+  }
+
+  sprintf(spec, "x:%s", range);
+
+  if( pack_range(spec, &dummy, &from, &to) < 0 ) {
+    if( errno == EINVAL ) {
+      fprintf(stderr, "%s: %s: case ids must be ID or FROM-TO, FROM <= TO\n",
+              progname, range);
+      exit(1);
+    }
+
+    usage();
+  }
+
+  openpack( &p, path, 0 );
+
+  for( id = from ; ; id++ ) {
+    if( pack_find(&p, id, &e) < 0 ) {
+      fprintf(stderr, "%s: %s: no case %llu\n", progname, path,
+              (unsigned long long) id);
+      exit(1);
+    }
+
+    snprintf(name, sizeof(name), "%s/%llu", dir, (unsigned long long) id);
+
+    if( (f = fopen(name, "wb")) == NULL ||
+        fwrite(p.map + e.off, 1, e.len, f) != e.len || fclose(f) == EOF ) {
+      perror(name);
+      exit(1);
+    }
+
+    /* Stop here rather than let "id" wrap past the largest id */
+    if( id == to ) {
+      break;
+    }
+  }
+
+  free( spec );
+  free( dummy );
+  pack_close( &p );
+}
@@ -0,0 +1,745 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  Mutants of an input file, see mutate.h
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "mutate.h"
+
+#define MAXOPS  8               /* Mutations on top of each other */
+#define MAXINS  (1 << 20)       /* Longest insert of a recorded ins */
+
+#define OP_FLIP 0
+#define OP_SET  1
+#define OP_INS  2
+#define OP_DEL  3
+#define OP_DUP  4
+#define OP_PUT  5
+#define OP_LINE 6               /* Copy a line to the start of a line */
+#define NOPS    7
+#define PUTMAX  (MUT_OPSMAX / 2 - 1)    /* Longest put, in hex in the ops */
+
+/* Tokens for put: terminal controls, format strings, edge numbers */
+#define T(s) { s, sizeof(s) - 1 }
+
+static struct {
+  char *s;
+  int   n;
+} tokens[] = {
+  T("\033["), T("\033[6n"), T("\033]0;"), T("\033P"), T("\r\n"), T("\0"),
+  T("\003"), T("\004"), T("\032"), T("\177"), T("%s%s%s%n"), T("%x%x"),
+  T("-1"), T("0"), T("2147483648"), T("4294967295"),
+  T("18446744073709551616"), T("1e999"), T("../"), T("\\"), T("'"),
+  T("\""), T("`"), T("${"), T("\377\376")
+};
+
+/* Byte values for set that often matter */
+static unsigned char values[] = {
+  0, 1, 3, 4, '\n', '\r', 27, 32, 127, 128, 255
+};
+
+
+static int       room(struct mutant *m, int n);
+static int       split(struct mutant *m, long long pos);
+static int       splice(struct mutant *m, long long pos, long long del,
+                        struct piece *ins, int nins);
+static long long stash(struct mutant *m, char *p, size_t n);
+static int       byteat(struct mutant *m, long long pos);
+static long long findlf(struct mutant *m, long long pos);
+static long long linestart(struct mutant *m, long long pos);
+static int       addop(struct mutant *m, char *fmt, ...);
+static int       unop(struct mutant *m, int at);
+static int       mflip(struct mutant *m, long long p, int b);
+static int       mset(struct mutant *m, long long p, int v);
+static int       mins(struct mutant *m, long long p, long long l, long long o,
+                      struct fuzzgen *payload);
+static int       mdel(struct mutant *m, long long p, long long l);
+static int       mdup(struct mutant *m, long long p, long long l, long long q);
+static int       mput(struct mutant *m, long long p, char *s, int n);
+
+
+/*
+ * Map the input "path".  Returns -1 with errno set on failure.
+ */
+int mut_open( struct mutant *m, char *path ) {
+  struct stat st;
+  int         fd;
+
+
+  memset( m, 0, sizeof(*m) );
+
+  if( (fd = open(path, O_RDONLY)) < 0 ) {
+    return( -1 );
+  }
+
+  if( fstat(fd, &st) < 0 ) {
+    (void) close( fd );
+    return( -1 );
+  }
+
+  m->inlen = st.st_size;
+
+  if( m->inlen > 0 ) {
+    m->in = mmap( NULL, m->inlen, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+    if( m->in == MAP_FAILED ) {
+      m->in = NULL;
+      (void) close( fd );
+      return( -1 );
+    }
+  }
+
+  (void) close( fd );
+  mut_reset( m );
+
+  return( 0 );
+}
+
+
+void mut_close( struct mutant *m ) {
+  if( m->in != NULL ) {
+    munmap( m->in, m->inlen );
+  }
+
+  free( m->pcs );
+  free( m->scratch );
+
+  m->in      = NULL;
+  m->pcs     = NULL;
+  m->scratch = NULL;
+}
+
+
+/*
+ * Start a new mutant: the input as it is
+ */
+void mut_reset( struct mutant *m ) {
+  m->npcs   = 0;
+  m->len    = m->inlen;
+  m->slen   = 0;
+  m->poff   = 0;
+  m->ops[0] = 0;
+
+  if( m->inlen > 0 && room(m, 1) == 0 ) {
+    m->pcs[0].src = MUT_INPUT;
+    m->pcs[0].off = 0;
+    m->pcs[0].len = m->inlen;
+    m->npcs       = 1;
+  }
+}
+
+
+/*
+ * Bytes of piece "i"
+ */
+char *mut_piece( struct mutant *m, int i, long long *len ) {
+  *len = m->pcs[i].len;
+
+  if( m->pcs[i].src == MUT_INPUT ) {
+    return( m->in + m->pcs[i].off );
+  }
+
+  return( m->scratch + m->pcs[i].off );
+}
+
+
+/*
+ * Apply 1 to MAXOPS random mutations, drawn from "r".  Inserted
+ * bytes come from "payload" in turn.  With "lines", only whole lines
+ * of at most that many bytes are copied, deleted and inserted.
+ * Stops early, with the mutations so far, once their text is full.
+ * Returns -1 with errno set on failure.
+ */
+int mut_random( struct mutant *m, struct fuzzgen *r, struct fuzzgen *payload,
+                int lines ) {
+  long long p, q, l;
+  int       nops, op, t, v;
+
+
+  nops = 1 + (int) fuzzgen_below(r, MAXOPS);
+
+  while( nops-- > 0 ) {
+    op = (int) fuzzgen_below(r, NOPS);
+
+    if( lines ) {
+      op = m->len == 0 ? OP_INS : (op % 3 == 0 ? OP_INS : op % 3 == 1 ? OP_DEL : OP_LINE);
+    }
+    else if( m->len == 0 && op != OP_PUT ) {
+      op = OP_INS;
+    }
+
+    switch( op ) {
+      case OP_FLIP:
+        p = fuzzgen_below( r, m->len );
+
+        if( mflip(m, p, (int) fuzzgen_below(r, 8)) < 0 ) {
+          goto fail;
+        }
+        break;
+
+      case OP_SET:
+        p = fuzzgen_below( r, m->len );
+        v = fuzzgen_below(r, 2) ? values[fuzzgen_below(r, sizeof(values))]
+                                : (int) fuzzgen_below(r, 256);
+
+        if( mset(m, p, v) < 0 ) {
+          goto fail;
+        }
+        break;
+
+      case OP_INS:
+        /* Short inserts are the more useful, so favour them */
+        if( lines ) {
+          p = linestart( m, fuzzgen_below(r, m->len + 1) );
+          l = fuzzgen_below( r, lines );
+        }
+        else {
+          p = fuzzgen_below( r, m->len + 1 );
+          l = 1 + fuzzgen_below( r, 1 + fuzzgen_below(r, 256) );
+        }
+
+        if( (l > 0 && mins(m, p, l, m->poff, payload) < 0) ||
+            (lines && mput(m, p + l, "\n", 1) < 0) ) {
+          goto fail;
+        }
+        break;
+
+      case OP_DEL:
+      case OP_DUP:
+      case OP_LINE:
+        if( op == OP_LINE || lines ) {
+          /* A whole line, LF included if it has one */
+          if( (p = linestart(m, fuzzgen_below(r, m->len))) == m->len ) {
+            p = 0;
+          }
+
+          l = (q = findlf(m, p)) < 0 ? m->len - p : q + 1 - p;
+        }
+        else {
+          l = m->len < 1024 ? m->len : 1024;
+          l = 1 + fuzzgen_below( r, 1 + fuzzgen_below(r, l) );
+          p = fuzzgen_below( r, m->len - l + 1 );
+        }
+
+        if( op == OP_DEL ) {
+          if( mdel(m, p, l) < 0 ) {
+            goto fail;
+          }
+          break;
+        }
+
+        q = fuzzgen_below( r, m->len + 1 );
+
+        if( op == OP_LINE || lines ) {
+          q = linestart( m, q );
+        }
+
+        if( mdup(m, p, l, q) < 0 ) {
+          goto fail;
+        }
+        break;
+
+      case OP_PUT:
+        if( m->dict != NULL ) {
+          t = fuzzgen_dict_pick( r, m->dict );
+          p = fuzzgen_below( r, m->len + 1 );
+
+          /* A token too long to record is passed over */
+          if( m->dict->len[t] <= PUTMAX &&
+              mput(m, p, m->dict->arena + m->dict->off[t], m->dict->len[t]) < 0 ) {
+            goto fail;
+          }
+          break;
+        }
+
+        t = (int) fuzzgen_below( r, sizeof(tokens) / sizeof(tokens[0]) );
+
+        if( mput(m, fuzzgen_below(r, m->len + 1), tokens[t].s, tokens[t].n) < 0 ) {
+          goto fail;
+        }
+        break;
+    }
+  }
+
+  return( 0 );
+
+fail:
+  /* Out of room for the text: keep the mutations it holds */
+  return( errno == ENOSPC && m->ops[0] != 0 ? 0 : -1 );
+}
+
+
+/*
+ * Apply the mutations "ops", as kept by an earlier mutant.  Returns
+ * -1 with errno EINVAL if they do not fit the input.
+ */
+int mut_apply( struct mutant *m, char *ops, struct fuzzgen *payload ) {
+  char      buf[MUT_OPSMAX], hex[MUT_OPSMAX], *s;
+  long long p, l, o;
+  int       b, i, c, e;
+
+
+  if( strlen(ops) >= sizeof(buf) ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  strcpy( buf, ops );
+
+  for( s = strtok(buf, ",") ; s != NULL ; s = strtok(NULL, ",") ) {
+    e = -1;
+    errno = EINVAL;
+
+    if( sscanf(s, "flip:%lld:%d%n", &p, &b, &i) == 2 && s[i] == 0 ) {
+      e = mflip( m, p, b );
+    }
+    else if( sscanf(s, "set:%lld:%d%n", &p, &b, &i) == 2 && s[i] == 0 ) {
+      e = mset( m, p, b );
+    }
+    else if( sscanf(s, "ins:%lld:%lld:%lld%n", &p, &l, &o, &i) == 3 && s[i] == 0 ) {
+      e = mins( m, p, l, o, payload );
+    }
+    else if( sscanf(s, "del:%lld:%lld%n", &p, &l, &i) == 2 && s[i] == 0 ) {
+      e = mdel( m, p, l );
+    }
+    else if( sscanf(s, "dup:%lld:%lld:%lld%n", &p, &l, &o, &i) == 3 && s[i] == 0 ) {
+      e = mdup( m, p, l, o );
+    }
+    else if( sscanf(s, "put:%lld:%[0-9a-f]%n", &p, hex, &i) == 2 && s[i] == 0 &&
+             strlen(hex) % 2 == 0 ) {
+      for( i = 0 ; hex[2 * i] != 0 ; i++ ) {
+        (void) sscanf( hex + 2 * i, "%2x", &c );
+        hex[i] = (char) c;
+      }
+
+      e = mput( m, p, hex, i );
+    }
+
+    if( e < 0 ) {
+      return( -1 );
+    }
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * The mutations.  Each checks its arguments against the mutant and
+ * returns -1 with errno EINVAL if they do not fit.  It records itself
+ * before it changes the mutant, so that a mutation with no room left
+ * in the text fails with ENOSPC and leaves the mutant as it was.
+ */
+static int mflip( struct mutant *m, long long p, int b ) {
+  char c;
+  int  at;
+
+
+  if( p < 0 || p >= m->len || b < 0 || b > 7 ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  c = (char) (byteat(m, p) ^ (1 << b));
+
+  if( (at = addop(m, "flip:%lld:%d", p, b)) < 0 ) {
+    return( -1 );
+  }
+
+  if( mput(m, p, &c, -1) < 0 ) {
+    return( unop(m, at) );
+  }
+
+  return( 0 );
+}
+
+
+static int mset( struct mutant *m, long long p, int v ) {
+  char c = (char) v;
+  int  at;
+
+
+  if( p < 0 || p >= m->len || v < 0 || v > 255 ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  if( (at = addop(m, "set:%lld:%d", p, v)) < 0 ) {
+    return( -1 );
+  }
+
+  if( mput(m, p, &c, -1) < 0 ) {
+    return( unop(m, at) );
+  }
+
+  return( 0 );
+}
+
+
+static int mins( struct mutant *m, long long p, long long l, long long o,
+                 struct fuzzgen *payload ) {
+  struct piece pc;
+  int          at;
+
+
+  if( p < 0 || p > m->len || l <= 0 || l > MAXINS || o < 0 ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  if( (at = addop(m, "ins:%lld:%lld:%lld", p, l, o)) < 0 ) {
+    return( -1 );
+  }
+
+  if( (pc.off = stash(m, NULL, l)) < 0 ) {
+    return( unop(m, at) );
+  }
+
+  fuzzgen_seek( payload, o );
+
+  if( fuzzgen_fill(payload, m->scratch + pc.off, l) < 0 ) {
+    return( unop(m, at) );
+  }
+
+  pc.src  = MUT_SCRATCH;
+  pc.len  = l;
+
+  if( splice(m, p, 0, &pc, 1) < 0 ) {
+    return( unop(m, at) );
+  }
+
+  m->poff = o + l;
+
+  return( 0 );
+}
+
+
+static int mdel( struct mutant *m, long long p, long long l ) {
+  int at;
+
+
+  if( p < 0 || l <= 0 || p > m->len - l ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  if( (at = addop(m, "del:%lld:%lld", p, l)) < 0 ) {
+    return( -1 );
+  }
+
+  if( splice(m, p, l, NULL, 0) < 0 ) {
+    return( unop(m, at) );
+  }
+
+  return( 0 );
+}
+
+
+static int mdup( struct mutant *m, long long p, long long l, long long q ) {
+  struct piece *cp;
+  int           i, j, e, at;
+
+
+  if( p < 0 || l <= 0 || p > m->len - l || q < 0 || q > m->len ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  if( (at = addop(m, "dup:%lld:%lld:%lld", p, l, q)) < 0 ) {
+    return( -1 );
+  }
+
+  /* The pieces of the block, copied as splice() moves them about */
+  if( (i = split(m, p)) < 0 || (j = split(m, p + l)) < 0 ) {
+    return( unop(m, at) );
+  }
+
+  if( (cp = (struct piece *) malloc((j - i) * sizeof(struct piece))) == NULL ) {
+    return( unop(m, at) );
+  }
+
+  memcpy( cp, m->pcs + i, (j - i) * sizeof(struct piece) );
+  e = splice( m, q, 0, cp, j - i );
+  free( cp );
+
+  if( e < 0 ) {
+    return( unop(m, at) );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Insert the "n" bytes at "s" at "p".  With "n" < 0, replace the
+ * byte at "p" with the one at "s" instead, and record nothing.
+ */
+static int mput( struct mutant *m, long long p, char *s, int n ) {
+  struct piece pc;
+  char         hex[MUT_OPSMAX];
+  int          i, at = -1;
+
+
+  if( p < 0 || p > m->len - (n < 0) || n > PUTMAX ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  if( n >= 0 ) {
+    for( i = 0 ; i < n ; i++ ) {
+      sprintf( hex + 2 * i, "%02x", (unsigned char) s[i] );
+    }
+
+    hex[2 * n] = 0;
+
+    if( (at = addop(m, "put:%lld:%s", p, hex)) < 0 ) {
+      return( -1 );
+    }
+  }
+
+  if( (pc.off = stash(m, s, n < 0 ? 1 : n)) < 0 ) {
+    return( at < 0 ? -1 : unop(m, at) );
+  }
+
+  pc.src = MUT_SCRATCH;
+  pc.len = n < 0 ? 1 : n;
+
+  if( splice(m, p, n < 0, &pc, pc.len > 0) < 0 ) {
+    return( at < 0 ? -1 : unop(m, at) );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Add a mutation to the text of the mutant.  Returns where it starts,
+ * for unop(), or -1 with errno ENOSPC if there is no room for it.
+ */
+static int addop( struct mutant *m, char *fmt, ... ) {
+  va_list ap;
+  size_t  l = strlen(m->ops);
+  int     n;
+
+
+  if( l > 0 ) {
+    if( l + 1 >= sizeof(m->ops) ) {
+      errno = ENOSPC;
+      return( -1 );
+    }
+
+    m->ops[l++] = ',';
+  }
+
+  va_start( ap, fmt );
+  n = vsnprintf( m->ops + l, sizeof(m->ops) - l, fmt, ap );
+  va_end( ap );
+
+  if( n < 0 || (size_t) n >= sizeof(m->ops) - l ) {
+    m->ops[l - (l > 0)] = 0;
+    errno = ENOSPC;
+    return( -1 );
+  }
+
+  return( (int) (l - (l > 0)) );
+}
+
+
+/*
+ * Take back the mutation addop() put "at" in the text, when making it
+ * failed.  Returns -1 for the caller, with errno as the failure left it.
+ */
+static int unop( struct mutant *m, int at ) {
+  m->ops[at] = 0;
+  return( -1 );
+}
+
+
+/*
+ * Make room for "n" more pieces
+ */
+static int room( struct mutant *m, int n ) {
+  struct piece *p;
+  int           want;
+
+
+  if( m->npcs + n <= m->maxpcs ) {
+    return( 0 );
+  }
+
+  for( want = m->maxpcs ? m->maxpcs : 16 ; want < m->npcs + n ; want *= 2 )
+    ;
+
+  if( (p = (struct piece *) realloc(m->pcs, want * sizeof(struct piece))) == NULL ) {
+    return( -1 );
+  }
+
+  m->pcs    = p;
+  m->maxpcs = want;
+
+  return( 0 );
+}
+
+
+/*
+ * Make a piece start at "pos", 0 <= pos <= len, and return its
+ * index (npcs for the end)
+ */
+static int split( struct mutant *m, long long pos ) {
+  long long at = 0;
+  int       i;
+
+
+  for( i = 0 ; i < m->npcs ; at += m->pcs[i++].len ) {
+    if( at == pos ) {
+      return( i );
+    }
+
+    if( pos < at + m->pcs[i].len ) {
+      if( room(m, 1) < 0 ) {
+        return( -1 );
+      }
+
+      memmove( m->pcs + i + 2, m->pcs + i + 1,
+               (m->npcs - i - 1) * sizeof(struct piece) );
+      m->pcs[i + 1]      = m->pcs[i];
+      m->pcs[i + 1].off += pos - at;
+      m->pcs[i + 1].len -= pos - at;
+      m->pcs[i].len      = pos - at;
+      m->npcs++;
+
+      return( i + 1 );
+    }
+  }
+
+  return( m->npcs );
+}
+
+
+/*
+ * Replace the "del" bytes at "pos" with the "nins" pieces at "ins"
+ */
+static int splice( struct mutant *m, long long pos, long long del,
+                   struct piece *ins, int nins ) {
+  int i, j, k;
+
+
+  if( (i = split(m, pos)) < 0 || (j = split(m, pos + del)) < 0 ||
+      room(m, nins) < 0 ) {
+    return( -1 );
+  }
+
+  memmove( m->pcs + i + nins, m->pcs + j, (m->npcs - j) * sizeof(struct piece) );
+  m->npcs += nins - (j - i);
+  m->len  -= del;
+
+  for( k = 0 ; k < nins ; k++ ) {
+    m->pcs[i + k] = ins[k];
+    m->len       += ins[k].len;
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Append "n" bytes at "p" (or room for them if "p" is NULL) to the
+ * scratch buffer and return where they went
+ */
+static long long stash( struct mutant *m, char *p, size_t n ) {
+  size_t want;
+  char  *s;
+
+
+  if( m->slen + n > m->ssize ) {
+    for( want = m->ssize ? m->ssize : 4096 ; want < m->slen + n ; want *= 2 )
+      ;
+
+    if( (s = (char *) realloc(m->scratch, want)) == NULL ) {
+      return( -1 );
+    }
+
+    m->scratch = s;
+    m->ssize   = want;
+  }
+
+  if( p != NULL ) {
+    memcpy( m->scratch + m->slen, p, n );
+  }
+
+  m->slen += n;
+
+  return( (long long) (m->slen - n) );
+}
+
+
+static int byteat( struct mutant *m, long long pos ) {
+  long long len;
+  int       i;
+
+
+  for( i = 0 ; pos >= m->pcs[i].len ; i++ ) {
+    pos -= m->pcs[i].len;
+  }
+
+  return( (unsigned char) mut_piece(m, i, &len)[pos] );
+}
+
+
+/*
+ * Position of the first LF at or after "pos", or -1
+ */
+static long long findlf( struct mutant *m, long long pos ) {
+  long long at = 0, len, from;
+  char     *p, *lf;
+  int       i;
+
+
+  for( i = 0 ; i < m->npcs ; at += len, i++ ) {
+    p = mut_piece( m, i, &len );
+
+    if( at + len <= pos ) {
+      continue;
+    }
+
+    from = pos > at ? pos - at : 0;
+
+    if( (lf = memchr(p + from, '\n', len - from)) != NULL ) {
+      return( at + (lf - p) );
+    }
+  }
+
+  return( -1 );
+}
+
+
+/*
+ * Start of the first line at or after "pos" (len if there is none)
+ */
+static long long linestart( struct mutant *m, long long pos ) {
+  long long lf;
+
+
+  if( pos == 0 ) {
+    return( 0 );
+  }
+
+  return( (lf = findlf(m, pos - 1)) < 0 ? m->len : lf + 1 );
+}
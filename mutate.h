@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  Mutants of an input file
+ *
+ *  The input is mapped once.  A mutant is a list of pieces, each a
+ *  run of bytes of the input or of a scratch buffer that holds the
+ *  bytes the mutations brought in, so making one never copies the
+ *  input, and writing it out hands the pieces to writev() as they
+ *  are.  The mutations are kept as text, e.g.
+ *
+ *      flip:12:3,ins:40:9:0,dup:0:17:80,put:5:1b5b
+ *
+ *  which is enough to make the mutant again from the input:
+ *
+ *      flip:P:B        flip bit B of byte P
+ *      set:P:V         set byte P to V
+ *      ins:P:L:O       insert at P the L bytes of the payload stream
+ *                      from its byte O on
+ *      del:P:L         delete L bytes at P
+ *      dup:P:L:Q       insert a copy of the L bytes at P at Q
+ *      put:P:HEX       insert the bytes HEX at P
+ *
+ *  The tokens that put inserts are those of "dict" if there is one.
+ */
+
+#ifndef MUTATE_H
+#define MUTATE_H
+
+#include <stddef.h>
+
+#include "fuzzgen.h"
+
+#define MUT_INPUT   0           /* Where the bytes of a piece are */
+#define MUT_SCRATCH 1
+
+#define MUT_OPSMAX  8192        /* Longest text of the mutations */
+
+struct piece {
+  int       src;
+  long long off, len;
+};
+
+struct mutant {
+  char         *in;             /* The input, mapped */
+  long long     inlen;
+  struct piece *pcs;            /* The mutant */
+  int           npcs, maxpcs;
+  long long     len;
+  char         *scratch;
+  size_t        slen, ssize;
+  long long     poff;           /* Payload used so far */
+  const struct fuzzgen_dict *dict; /* Tokens of put, NULL for built-in ones */
+  char          ops[MUT_OPSMAX];
+};
+
+int   mut_open(struct mutant *m, char *path);
+void  mut_close(struct mutant *m);
+void  mut_reset(struct mutant *m);
+int   mut_random(struct mutant *m, struct fuzzgen *r, struct fuzzgen *payload,
+                 int lines);
+int   mut_apply(struct mutant *m, char *ops, struct fuzzgen *payload);
+char *mut_piece(struct mutant *m, int i, long long *len);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  Pacing of output to a byte rate, shared by fuzz and ptyjig
+ */
+
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "pace.h"
+
+#define PACE_SPIN 20000L        /* Spin instead of sleeping below this (ns) */
+#define NSEC      1000000000L
+
+
+/*
+ * Set up pacing at "rate" bytes per second, waiting after every
+ * "burst" bytes.  A rate of 0 turns pacing off.
+ */
+void pace_init( struct pace *p, double rate, long burst ) {
+  p->rate    = rate;
+  p->burst   = burst > 0 ? burst : 1;
+  p->pending = 0;
+  p->sent    = 0;
+  p->sleeps  = 0;
+
+#ifdef __linux__
+  /* Do not let the kernel round our wakeups up by the default 50us */
+  if( rate > 0 ) {
+    (void) prctl( PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL );
+  }
+#endif
+}
+
+
+/*
+ * Nanoseconds from "a" to "b"
+ */
+static long long nsdiff( struct timespec *a, struct timespec *b ) {
+  return( (long long) (b->tv_sec - a->tv_sec) * NSEC + (b->tv_nsec - a->tv_nsec) );
+}
+
+
+/*
+ * Account for "n" bytes just sent, without waiting.  At the end of a
+ * burst, returns TRUE with the time the bytes sent so far are due in
+ * "due", before which no more should be sent.
+ */
+int pace_count( struct pace *p, long n, struct timespec *due ) {
+  long long at;
+
+
+  if( p->rate <= 0 || n <= 0 ) {
+    return( 0 );
+  }
+
+  if( p->sent == 0 ) {
+    clock_gettime( CLOCK_MONOTONIC, &p->start );
+  }
+
+  p->sent    += n;
+  p->pending += n;
+
+  if( p->pending < p->burst ) {
+    return( 0 );
+  }
+
+  p->pending = 0;
+
+  at = (long long) ((double) p->sent / p->rate * NSEC);
+  due->tv_sec  = p->start.tv_sec  + at / NSEC;
+  due->tv_nsec = p->start.tv_nsec + at % NSEC;
+
+  if( due->tv_nsec >= NSEC ) {
+    due->tv_sec++;
+    due->tv_nsec -= NSEC;
+  }
+
+  return( 1 );
+}
+
+
+/*
+ * Account for "n" bytes just sent.  At the end of a burst, wait until
+ * the bytes sent so far are due: sleep to just before the deadline,
+ * then spin up to it.
+ */
+void pace_sent( struct pace *p, long n ) {
+  struct timespec now, due, nap;
+
+
+  if( !pace_count(p, n, &due) ) {
+    return;
+  }
+
+  nap = due;
+  nap.tv_nsec -= PACE_SPIN;
+
+  if( nap.tv_nsec < 0 ) {
+    nap.tv_sec--;
+    nap.tv_nsec += NSEC;
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &now );
+
+  if( nsdiff(&now, &nap) > 0 ) {
+    do {
+      p->sleeps++;
+    } while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nap, NULL) == EINTR );
+  }
+
+  do {
+    clock_gettime( CLOCK_MONOTONIC, &now );
+  } while( nsdiff(&now, &due) > 0 );
+}
+
+
+/*
+ * Rate achieved so far, in bytes per second
+ */
+double pace_achieved( struct pace *p ) {
+  struct timespec now;
+  long long       ns;
+
+
+  if( p->sent == 0 ) {
+    return( 0.0 );
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  ns = nsdiff( &p->start, &now );
+
+  return( ns > 0 ? (double) p->sent * NSEC / ns : 0.0 );
+}
+
+
+/*
+ * Print what was asked for and what was achieved on "f"
+ */
+void pace_report( struct pace *p, FILE *f, char *who ) {
+  struct timespec now;
+
+
+  if( p->rate <= 0 ) {
+    return;
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &now );
+
+  fprintf( f, "%s: %llu bytes in %.6f s, %.1f bytes/s (target %.1f, burst %ld)\n",
+           who, p->sent,
+           p->sent ? nsdiff(&p->start, &now) / (double) NSEC : 0.0,
+           pace_achieved(p), p->rate, p->burst );
+}
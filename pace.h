@@ -0,0 +1,38 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  Pacing of output to a byte rate, shared by fuzz and ptyjig
+ *
+ *  Bytes are sent in bursts; after each burst the sender waits until
+ *  the absolute time at which the bytes sent so far are due, so that
+ *  sleeping late does not add up over a run.
+ */
+
+#ifndef PACE_H
+#define PACE_H
+
+#include <stdio.h>
+#include <time.h>
+
+struct pace {
+  double             rate;      /* Bytes per second, 0 for no pacing */
+  long               burst;     /* Bytes sent between waits */
+  long               pending;   /* Bytes sent since the last wait */
+  unsigned long long sent;      /* Bytes sent in all */
+  unsigned long long sleeps;    /* clock_nanosleep() calls to wait */
+  struct timespec    start;     /* When the first byte went out */
+};
+
+void   pace_init(struct pace *p, double rate, long burst);
+int    pace_count(struct pace *p, long n, struct timespec *due);
+void   pace_sent(struct pace *p, long n);
+double pace_achieved(struct pace *p);
+void   pace_report(struct pace *p, FILE *f, char *who);
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  Corpus pack files, see pack.h
+ */
+
+#define _GNU_SOURCE             /* pwritev() */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "pack.h"
+
+
+static uint64_t get64( const char *s ) {
+  const unsigned char *u = (const unsigned char *) s;
+  uint64_t             v = 0;
+  int                  i;
+
+
+  for( i = 7 ; i >= 0 ; i-- ) {
+    v = v << 8 | u[i];
+  }
+
+  return( v );
+}
+
+
+static void put64( char *s, uint64_t v ) {
+  int i;
+
+
+  for( i = 0 ; i < 8 ; i++ ) {
+    s[i] = (char) (v >> (8 * i));
+  }
+}
+
+
+/*
+ * Write all of "cnt" buffers at "iov" at offset "off", however many
+ * calls it takes; one write stops short at about 2 GiB on Linux.
+ */
+static int pwritev_all( int fd, struct iovec *iov, int cnt, uint64_t off ) {
+  ssize_t n;
+
+
+  while( cnt > 0 ) {
+    if( iov->iov_len == 0 ) {
+      iov++;
+      cnt--;
+      continue;
+    }
+
+    if( (n = pwritev(fd, iov, cnt, (off_t) off)) < 0 ) {
+      if( errno == EINTR ) {
+        continue;
+      }
+
+      return( -1 );
+    }
+
+    if( n == 0 ) {
+      errno = ENOSPC;
+      return( -1 );
+    }
+
+    off += n;
+
+    while( cnt > 0 && (size_t) n >= iov->iov_len ) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+
+    if( cnt > 0 ) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Open the pack "path", creating it if "writable" and it does not
+ * exist.  Returns -1 with errno set on failure, EINVAL if the file
+ * is not a pack.
+ */
+int pack_open( struct pack *p, char *path, int writable ) {
+  struct stat st;
+  char        hdr[PACKHDR];
+
+
+  memset( p, 0, sizeof(*p) );
+
+  if( (p->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0666)) < 0 ) {
+    return( -1 );
+  }
+
+  if( fstat(p->fd, &st) < 0 ) {
+    goto fail;
+  }
+
+  /* A new pack: just the header */
+  if( st.st_size == 0 && writable ) {
+    memset( hdr, 0, sizeof(hdr) );
+    memcpy( hdr, PACKMAGIC, 8 );
+    put64( hdr + 8,  PACKVERSION );
+    put64( hdr + 16, PACKHDR );
+    put64( hdr + 24, 0 );
+
+    if( pwrite(p->fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ) {
+      goto fail;
+    }
+
+    st.st_size = PACKHDR;
+  }
+
+  if( st.st_size < PACKHDR ) {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  p->size = st.st_size;
+  p->map  = mmap( NULL, p->size, PROT_READ, MAP_SHARED, p->fd, 0 );
+
+  if( p->map == MAP_FAILED ) {
+    p->map = NULL;
+    goto fail;
+  }
+
+  if( memcmp(p->map, PACKMAGIC, 8) != 0 || get64(p->map + 8) != PACKVERSION ) {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  p->ioff  = get64( p->map + 16 );
+  p->count = get64( p->map + 24 );
+
+  if( p->ioff > p->size || p->count > (p->size - p->ioff) / PACKENT ) {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  p->end    = p->size;
+  p->nextid = 0;
+
+  if( p->count > 0 ) {
+    p->nextid = get64( p->map + p->ioff + (p->count - 1) * PACKENT ) + 1;
+  }
+
+  return( 0 );
+
+fail:
+  pack_close( p );
+  return( -1 );
+}
+
+
+/*
+ * Entry "i" of the index.  Returns -1 if it points outside the file.
+ */
+int pack_entry( struct pack *p, uint64_t i, struct packent *e ) {
+  char *s = p->map + p->ioff + i * PACKENT;
+
+
+  e->id   = get64( s );
+  e->off  = get64( s + 8 );
+  e->len  = get64( s + 16 );
+  e->moff = get64( s + 24 );
+  e->mlen = get64( s + 32 );
+
+  if( e->off > p->size || e->len > p->size - e->off ||
+      e->moff > p->size || e->mlen > p->size - e->moff ) {
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Look up case "id".  Returns -1 if it is not in the pack, or if
+ * the index points outside the file.
+ */
+int pack_find( struct pack *p, uint64_t id, struct packent *e ) {
+  uint64_t lo = 0, hi = p->count, mid;
+
+
+  while( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+
+    if( get64(p->map + p->ioff + mid * PACKENT) < id ) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  if( lo == p->count ) {
+    return( -1 );
+  }
+
+  if( pack_entry(p, lo, e) < 0 || e->id != id ) {
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Append a case of "len" bytes at "data" with "mlen" bytes of
+ * metadata.  Its id is put in "id".  The case is only in the index
+ * after pack_commit().
+ */
+int pack_append( struct pack *p, char *data, uint64_t len, char *meta,
+                 uint64_t mlen, uint64_t *id ) {
+  struct iovec iov[2];
+  char        *s;
+
+
+  if( (p->nadded & 1023) == 0 ) {
+    s = realloc( p->added, (p->nadded + 1024) * PACKENT );
+
+    if( s == NULL ) {
+      return( -1 );
+    }
+
+    p->added = s;
+  }
+
+  iov[0].iov_base = data;
+  iov[0].iov_len  = len;
+  iov[1].iov_base = meta;
+  iov[1].iov_len  = mlen;
+
+  if( pwritev_all(p->fd, iov, 2, p->end) < 0 ) {
+    return( -1 );
+  }
+
+  s = p->added + p->nadded * PACKENT;
+  put64( s,      p->nextid );
+  put64( s + 8,  p->end );
+  put64( s + 16, len );
+  put64( s + 24, p->end + len );
+  put64( s + 32, mlen );
+
+  if( id != NULL ) {
+    *id = p->nextid;
+  }
+
+  p->end += len + mlen;
+  p->nextid++;
+  p->nadded++;
+
+  return( 0 );
+}
+
+
+/*
+ * Write the index, old entries and appended ones, after the data,
+ * then point the header at it.
+ */
+int pack_commit( struct pack *p ) {
+  struct iovec iov[2];
+  char         hdr[16];
+  uint64_t     ilen;
+
+
+  if( p->nadded == 0 ) {
+    return( 0 );
+  }
+
+  iov[0].iov_base = p->map + p->ioff;
+  iov[0].iov_len  = p->count * PACKENT;
+  iov[1].iov_base = p->added;
+  iov[1].iov_len  = p->nadded * PACKENT;
+  ilen            = iov[0].iov_len + iov[1].iov_len;
+
+  if( pwritev_all(p->fd, iov, 2, p->end) < 0 ) {
+    return( -1 );
+  }
+
+  if( fdatasync(p->fd) < 0 ) {
+    return( -1 );
+  }
+
+  put64( hdr,     p->end );
+  put64( hdr + 8, p->count + p->nadded );
+
+  if( pwrite(p->fd, hdr, sizeof(hdr), 16) != sizeof(hdr) ) {
+    return( -1 );
+  }
+
+  /* Map the file again to see the new index */
+  munmap( p->map, p->size );
+  p->ioff   = p->end;
+  p->count += p->nadded;
+  p->end   += ilen;
+  p->size   = p->end;
+  p->nadded = 0;
+  p->map    = mmap( NULL, p->size, PROT_READ, MAP_SHARED, p->fd, 0 );
+
+  if( p->map == MAP_FAILED ) {
+    p->map = NULL;
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+void pack_close( struct pack *p ) {
+  if( p->map != NULL ) {
+    munmap( p->map, p->size );
+  }
+
+  if( p->fd >= 0 ) {
+    close( p->fd );
+  }
+
+  free( p->added );
+
+  p->map   = NULL;
+  p->fd    = -1;
+  p->added = NULL;
+}
+
+
+/*
+ * Split "PATH:ID" or "PATH:FROM-TO" into its parts.  "path" is
+ * allocated.  Returns -1 with errno ENOENT if "spec" does not have
+ * that form, or EINVAL if it does but the ids are negative or FROM
+ * is after TO.
+ */
+int pack_range( char *spec, char **path, uint64_t *from, uint64_t *to ) {
+  char              *colon, *s;
+  unsigned long long a, b;
+
+
+  if( (colon = strrchr(spec, ':')) == NULL || colon == spec ) {
+    errno = ENOENT;
+    return( -1 );
+  }
+
+  s = colon + 1;
+
+  if( *s == '-' && isdigit((unsigned char) s[1]) ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  if( !isdigit((unsigned char) *s) ) {
+    errno = ENOENT;
+    return( -1 );
+  }
+
+  errno = 0;
+  a = b = strtoull( s, &s, 10 );
+
+  if( *s == '-' ) {
+    if( !isdigit((unsigned char) s[1]) ) {
+      errno = EINVAL;
+      return( -1 );
+    }
+
+    b = strtoull( s + 1, &s, 10 );
+  }
+
+  if( *s != 0 ) {
+    errno = ENOENT;
+    return( -1 );
+  }
+
+  if( errno == ERANGE || b < a ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  if( (*path = strndup(spec, colon - spec)) == NULL ) {
+    return( -1 );
+  }
+
+  *from = a;
+  *to   = b;
+
+  return( 0 );
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  Corpus pack files
+ *
+ *  A pack holds many test cases in one file:
+ *
+ *      header   "FUZZPACK", version, index offset, number of cases
+ *      data     the bytes and metadata of the cases, appended in turn
+ *      index    per case: id, offset, length, metadata offset and length
+ *
+ *  All numbers are 64-bit little endian.  Appending writes the new
+ *  cases and a new index after the old one and then rewrites the
+ *  header, so a pack is never left without a valid index.  Ids are
+ *  given in increasing order, and the index is searched by halves.
+ */
+
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKMAGIC   "FUZZPACK"
+#define PACKVERSION 1
+#define PACKHDR     32          /* Bytes in the header */
+#define PACKENT     40          /* Bytes in an index entry */
+
+/* A case, as found in the index */
+struct packent {
+  uint64_t id;
+  uint64_t off, len;            /* Where its bytes are */
+  uint64_t moff, mlen;          /* Where its metadata is */
+};
+
+/* An open pack */
+struct pack {
+  int       fd;
+  char     *map;                /* The whole file, read only */
+  uint64_t  size;
+  uint64_t  count;              /* Cases in the index */
+  uint64_t  ioff;               /* Offset of the index */
+  uint64_t  end;                /* Where the next case goes */
+  char     *added;              /* Index entries of appended cases ... */
+  uint64_t  nadded;             /* ... not yet committed */
+  uint64_t  nextid;
+};
+
+int   pack_open(struct pack *p, char *path, int writable);
+int   pack_find(struct pack *p, uint64_t id, struct packent *e);
+int   pack_entry(struct pack *p, uint64_t i, struct packent *e);
+int   pack_append(struct pack *p, char *data, uint64_t len, char *meta,
+                  uint64_t mlen, uint64_t *id);
+int   pack_commit(struct pack *p);
+void  pack_close(struct pack *p);
+int   pack_range(char *spec, char **path, uint64_t *from, uint64_t *to);
+
+#endif
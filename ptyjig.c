@@ -1,6 +1,8 @@
 
 #define DEBUG_off
 
+#define _GNU_SOURCE             /* ptsname_r() */
+
 #define LINUX
 #define SOLARIS_off
 
@@ -32,11 +34,18 @@
  *  -i specifies a file to which the standard input is saved.
  *  -o specifies a file to which the standard output is saved.
  *  -d specifies a keystroke delay in seconds (floating point accepted.)
+ *  -c specifies a keystroke rate in characters per second instead.
+ *  -B specifies how many keystrokes are sent between waits (default 1).
+ *  -v reports the keystroke rate achieved with -d or -c.
  *  -t specifies a timeout interval.  The program will exit if the
  *     standard input is exhausted and "cmd" does not send output
  *     for "ttt" seconds.
+ *  -T specifies a limit on the whole run: "cmd" is killed after
+ *     "TTT" seconds, whatever it does.
  *  -w specifies another delay parameter. The program starts to send
  *     input to "cmd" after "www" seconds.
+ *  -q takes the input from the shared memory ring made by "fuzz -q
+ *     name" instead of stdin.
  *
  *  Defaults:
  *             -i /dev/nul -o /dev/nul -d 0 -t 2
@@ -71,8 +80,17 @@
 #include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
 
@@ -88,6 +106,16 @@
 #include <unistd.h>
 #include <sgtty.h>
 
+#include "pace.h"
+#include "ring.h"
+
+/* glibc has the pidfd_open() syscall number from 2.31 but P_PIDFD only from 2.36 */
+#if defined(SYS_pidfd_open) && defined(__GLIBC__)
+#if !__GLIBC_PREREQ(2, 36)
+#define P_PIDFD ((idtype_t) 3)
+#endif
+#endif
+
 #define ECHO      0000010
 #define CHILD     0
 #define RAW       040
@@ -98,6 +126,9 @@
 #define TRUE  1
 #define FALSE 0
 
+#define NSEC      1000000000LL
+#define CANON_MAX 4095  /* Bytes in a canonical line: the line buffer less the newline */
+
 
 /* GLOBAL VARIABLES */
 
@@ -117,25 +148,37 @@ int      flags = FALSE;
 int      flagx = FALSE;
 int      flagi = FALSE;
 int      flago = FALSE;
-unsigned flagt = 2 * 1000000;   /* Timeout interval in useconds */
+long long flagt = 2 * NSEC;     /* Timeout interval in nanoseconds */
+long long flagT = 0;            /* Limit on the run in nanoseconds */
 unsigned flagw = FALSE;         /* Starting wait in useconds */
-unsigned flagd = FALSE;         /* Delay between keystrokes in useconds */
+double   flagd = FALSE;         /* Delay between keystrokes in seconds */
+double   flagc = FALSE;         /* ... or keystrokes per second */
+long     flagB = 1;             /* Keystrokes between waits */
+int      flagv = FALSE;
+char*    flagq = NULL;          /* Input ring, instead of stdin */
+
+struct pace pace;
+struct ring ring;
+char*   keys;                   /* Keystrokes read but not yet sent ... */
+ssize_t nkeys;                  /* ... this many */
+char    inbuf[65536];           /* Keystrokes read from stdin */
+char    recbuf[8192];           /* Keystrokes on their way to "filei" */
 
 char* namei;
 char* nameo;
 FILE* filei;
 FILE* fileo;
 
-/* pids for the reader, writer and exec */
-int readerPID = -1;
-int writerPID = -1;
+/* pid of the exec, and a pidfd for it if the kernel has them */
 int execPID   = -1; 
+int pidfd     = -1;
 
 /* tty and pty file descriptors */
 int   tty = -1;
 int   pty = -1; 
 
 char  ttyNameUsed[40];
+int   unix98 = FALSE;           /* "ttyNameUsed" is a /dev/pts name */
 char* progname;
 
 /* for more verbose output at the end of execution */
@@ -183,8 +226,37 @@ struct  mesg {
 /* A flag indicating status of the writer */
 int writing = TRUE;
 
-/* A flag indicating status of the executing program */
-int executing = TRUE;
+/* The event loop, and what it waits for */
+int      epfd   = -1;
+int      sigfd  = -1;           /* signalfd for the signals we handle */
+int      pacefd = -1;           /* timerfd, when -d or -c lets us go on */
+int      quietfd = -1;          /* timerfd, when "cmd" may have been quiet
+                                   for "flagt", or had its second to die */
+int      capfd  = -1;           /* timerfd, when the run is over "flagT" */
+struct timespec heard;          /* When "cmd" last sent output */
+int      ringfd = -1;           /* eventfd, the ring has keystrokes ... */
+int      backfd = -1;           /* ... and eventfd, they are all sent */
+sigset_t oldmask;               /* Signal mask to give back to "cmd" */
+
+int stdinpoll = TRUE;           /* FALSE if stdin is a file */
+int inwatch   = FALSE;          /* Waiting for stdin to be readable */
+int inready   = FALSE;          /* stdin can be read without blocking */
+int ringready = FALSE;          /* The ring waiter has keystrokes */
+int paused    = FALSE;          /* Waiting for "pacefd" */
+int full      = FALSE;          /* Waiting for "pty" to take more */
+int sendeof   = FALSE;          /* The keystroke left is the EOF char */
+int dying     = FALSE;          /* Giving "cmd" a second to die */
+
+/* The line "cmd" reads, when its tty is in canonical mode */
+struct termios slave;           /* Its mode, as of the last write */
+int       linelen = 0;          /* Bytes in the line not yet ended */
+int       lnext   = FALSE;      /* The next byte is taken literally */
+long long dropped = 0;          /* Bytes held back from a full line */
+
+/* Handed from the ring waiter to the loop */
+char*   ringkeys;
+ssize_t nringkeys;
+pthread_t ringer;
 
 #ifdef SOLARIS
 struct sgttyb oldsb; /* terminal descriptors */
@@ -228,105 +300,136 @@ void done() {
 
 
 /*
- * Signal handler for SIGCHLD
+ * Send "sig" to "cmd".  Through the pidfd, the signal cannot reach
+ * some other process that got its pid once it is gone.
  */
-void sigchld(int sig) {
-  int pid;
-  union wait status;
-
+void killcmd( int sig ) {
+#ifdef SYS_pidfd_send_signal
+  if(  pidfd >= 0 && syscall( SYS_pidfd_send_signal, pidfd, sig, NULL, 0 ) == 0  ) {
+    return;
+  }
 
-#ifdef DEBUG
-  fprintf( stderr, "ptyjig: got signal SIGCHLD\n" );
+  if( pidfd >= 0 && errno == ESRCH ) {
+    return;
+  }
 #endif
 
-  /* Guarantee to return since a child is dead */
-  pid = wait3( (int*)&status, WUNTRACED, 0 );  
+  kill( execPID, sig );
+}
 
-  if( pid ) {
-#ifdef DEBUG
-    printf("ptyjig: pid = %d\n",pid);
-    printf("ptyjig: status = %d %d %d %d %d\n",
-            status.w_termsig,status.w_coredump,status.w_retcode,
-            status.w_stopval,status.w_stopsig);
-#endif
 
-    if( status.w_stopsig == SIGTSTP ) {
-      kill( pid, SIGCONT );
-    }
-    else {
-      signal( SIGINT,   SIG_DFL );
-      signal( SIGQUIT,  SIG_DFL ); 
-      signal( SIGTERM,  SIG_DFL ); 
-      signal( SIGWINCH, SIG_DFL ); 
-      signal( SIGCHLD,  SIG_IGN );
 
-      done();
+/*
+ * Clean up processes
+ */
+void clean() {
+#ifdef DEBUG
+  fprintf( stderr, "ptyjig: in clean()\n" );
+#endif
 
-      if( pid != execPID ) {
+  /* must close files, and kill all running processes */
+  if( execPID != -1 ) {
 #ifdef DEBUG
-        fprintf( stderr, "ptyjig: somebody killed my child\n" );
-        fprintf( stderr, "ptyjig: killing execPID = %d\n", execPID );
+    fprintf( stderr, "ptyjig: killing execPID = %d\n", execPID );
 #endif
+    killcmd( SIGKILL );
+  }
 
-        kill( execPID, SIGKILL);          /* kill the exec too */
-        kill( readerPID, status.w_termsig); /* use the same method to suicide */
-      }
+  done();
+}
 
 
-      kill( execPID, SIGKILL ); /* Just to make sure it is killed */
 
-      if( pid != writerPID && writerPID != -1 ) {
-#ifdef DEBUG
-        printf( "ptyjig: killing writerPID = %d\n", writerPID );
-#endif
-        kill( writerPID, SIGKILL );
-      }
+/*
+ * Pass on what is left in "pty", then exit the way "cmd" did: with
+ * its retcode if it terminates normally, with the signal if not.
+ * This is not exactly the same as csh, since the csh method is not
+ * too obvious.
+ */
+void finish( int sig, int core, int retcode ) {
+  char    c[BUFSIZ];
+  ssize_t i;
 
-      if( status.w_termsig ) {
-        fprintf( stderr,"ptyjig: %s: %s%s\n",progname,
-                 mesg[status.w_termsig].pname,
-                 status.w_coredump ? " (core dumped)" : "" );
-      }
 
-      /* If process terminates normally, return its retcode */
-      /* If abnormally, return termsig.  This is not exactly */
-      /* the same as csh, since the csh method is not too obvious */
+  while(  (i = read( pty, c, sizeof(c) )) > 0  ) {
+    if( !flagx ) {
+      (void) write( 1, c, i );
+    }
 
-      exit( status.w_termsig ? status.w_termsig : status.w_retcode );
+    if( flago ) {
+      (void) write( fileno(fileo), c, i );
     }
+  }
+
+  done();
 
-    exit(0);
+  if( sig ) {
+    fprintf( stderr,"ptyjig: %s: %s%s\n",progname,
+             (size_t) sig < sizeof(mesg) / sizeof(mesg[0]) ? mesg[sig].pname : "Signal",
+             core ? " (core dumped)" : "" );
   }
+
+  exit( sig ? sig : retcode );
 }
 
 
 
 /*
- * Clean up processes
+ * "cmd" changed state: it exited, through its pidfd or SIGCHLD, or it
+ * stopped, through SIGCHLD.  If it was stopped by a Control-Z it is
+ * resumed; otherwise we are done.
  */
-void clean() {
-#ifdef DEBUG
-  fprintf( stderr, "ptyjig: in clean()\n" );
-#endif
+void child() {
+  siginfo_t si;
+  int       r = -1;
 
-  signal( SIGCHLD, SIG_IGN ); /* Not necessary for sigchld to take over */
 
-  /* must close files, and kill all running processes */
-  if( execPID != -1 ) {
-#ifdef DEBUG
-    fprintf( stderr, "ptyjig: killing execPID = %d\n", execPID );
+  for( ;; ) {
+    si.si_pid = 0;
+
+#ifdef SYS_pidfd_open
+    if( pidfd >= 0 ) {
+      r = waitid( P_PIDFD, pidfd, &si, WEXITED | WSTOPPED | WNOHANG );
+    }
+
+    /* Linux 5.3 has pidfd_open() but waitid() does not take P_PIDFD */
+    if( pidfd < 0 || (r < 0 && errno == EINVAL) )
 #endif
-    kill( execPID, SIGKILL );
-  }
+    r = waitid( P_PID, execPID, &si, WEXITED | WSTOPPED | WNOHANG );
+
+    if( r < 0 || si.si_pid == 0 ) {
+      return;
+    }
 
-  if( writerPID != -1 ) {
 #ifdef DEBUG
-    fprintf( stderr, "ptyjig: killing writerPID = %d\n", writerPID );
+    fprintf( stderr, "ptyjig: pid = %d code = %d status = %d\n",
+             si.si_pid, si.si_code, si.si_status );
 #endif
-    kill( writerPID, SIGKILL );
-  }
 
-  done();
+    switch( si.si_code ) {
+      case CLD_STOPPED:
+        if( si.si_status == SIGTSTP ) {
+          killcmd( SIGCONT );
+          break;
+        }
+
+        killcmd( SIGKILL );
+        finish( si.si_status, FALSE, 0 );
+        break;
+
+      case CLD_EXITED:
+        finish( 0, FALSE, si.si_status );
+        break;
+
+      case CLD_KILLED:
+        finish( si.si_status, FALSE, 0 );
+        break;
+
+      case CLD_DUMPED:
+        finish( si.si_status, TRUE, 0 );
+        break;
+    }
+  }
 }
 
 
@@ -334,61 +437,39 @@ void clean() {
 /* 
  * Handle window size change SIGWINCH
  */
-void sigwinch(int sig) {
+void sigwinch() {
   struct winsize ws;
 
 
   ioctl( 0,   TIOCGWINSZ, &ws );
   ioctl( pty, TIOCSWINSZ, &ws );
 
-  kill( execPID, SIGWINCH );
+  killcmd( SIGWINCH );
 }
 
 
 
 /* 
- * Handle user interrupt SIGINT
+ * Handle user interrupt SIGINT, quit signal SIGQUIT and user terminate
+ * signal SIGTERM: clean up, then die of the same signal.
  */
-void clean_int(int sig) {
-#ifdef DEBUG
-  fprintf( stderr, "ptyjig: got signal SIGINT\n" );
-#endif
-
-  signal( SIGINT, SIG_DFL );
-  clean();
-
-  kill( readerPID, SIGINT );
-}
-
+void clean_sig( int sig ) {
+  sigset_t mask;
 
 
-/* 
- * Handle quit signal SIGQUIT
- */
-void clean_quit(int sig) {
 #ifdef DEBUG
-  fprintf( stderr, "ptyjig: got signal SIGQUIT\n" );
+  fprintf( stderr, "ptyjig: got signal %d\n", sig );
 #endif
 
   clean();
-  signal( SIGQUIT, SIG_DFL );
-  kill( readerPID, SIGQUIT );
-}
 
+  signal( sig, SIG_DFL );
+  sigemptyset( &mask );
+  sigaddset( &mask, sig );
+  sigprocmask( SIG_UNBLOCK, &mask, NULL );
 
-
-/* 
- * Handle user terminate signal SIGTERM
- */
-void clean_term(int sig) {
-#ifdef DEBUG
-  fprintf( stderr, "ptyjig: got signal SIGTERM\n" );
-#endif
-
-  clean();
-  signal( SIGTERM, SIG_DFL );
-
-  kill( readerPID, SIGTERM );
+  raise( sig );
+  exit( 1 );
 }
 
 
@@ -441,7 +522,8 @@ void fixtty() {
 
 
 /*
- * Opens a master pseudo-tty device on range ptyp0 ... ptyr9 
+ * Opens a master pseudo-tty device: a Unix98 one from /dev/ptmx, of
+ * which there is no fixed number, or else one on range ptyp0 ... ptyr9 
  */
 void setup_pty() {
   char    c;
@@ -450,6 +532,25 @@ void setup_pty() {
   int     foundOne = FALSE;
 
 
+  if(  (pty = posix_openpt( O_RDWR | O_NOCTTY )) >= 0  ) {
+#ifdef LINUX
+    if(  grantpt( pty ) == 0 && unlockpt( pty ) == 0 &&
+         ptsname_r( pty, ttyNameUsed, sizeof(ttyNameUsed) ) == 0  ) {
+      unix98 = TRUE;
+      return;
+    }
+#else
+    if(  grantpt( pty ) == 0 && unlockpt( pty ) == 0 && ptsname( pty ) != NULL &&
+         strlen( ptsname(pty) ) < sizeof(ttyNameUsed)  ) {
+      strcpy( ttyNameUsed, ptsname(pty) );
+      unix98 = TRUE;
+      return;
+    }
+#endif
+
+    close( pty );
+  }
+
   /*
    * Make up the pseudo-tty names, namely /dev/ptyp0.../dev/ptyr9 
    * Solaris can handle up to 's' and up to 16, respectively, but
@@ -506,7 +607,9 @@ void setup_tty() {
 #endif
 
   /* Open modified "ttyNameUsed" as the control terminal */
-  ttyNameUsed[5] = 't';
+  if( !unix98 ) {
+    ttyNameUsed[5] = 't';
+  }
   tty = open( ttyNameUsed, O_RDWR );
 
   if( tty < 0 ) {
@@ -535,10 +638,24 @@ void setup_tty() {
 
 
 /*
- * Sets boolean to false to stop CMD's execution?
+ * Arm the timerfd "fd" to go off at "ns" nanoseconds after "t", on
+ * CLOCK_MONOTONIC
  */
-void execute_done( int sig ) {
-  executing = FALSE;
+void arm( int fd, struct timespec* t, long long ns ) {
+  struct itimerspec its;
+
+
+  its.it_interval.tv_sec  = 0;
+  its.it_interval.tv_nsec = 0;
+  its.it_value.tv_sec     = t->tv_sec  + ns / NSEC;
+  its.it_value.tv_nsec    = t->tv_nsec + ns % NSEC;
+
+  if( its.it_value.tv_nsec >= NSEC ) {
+    its.it_value.tv_sec++;
+    its.it_value.tv_nsec -= NSEC;
+  }
+
+  timerfd_settime( fd, TFD_TIMER_ABSTIME, &its, NULL );
 }
 
 
@@ -549,10 +666,17 @@ void execute_done( int sig ) {
  * recorded by the other end of "tty". 
  */
 void execute( char** cmd ) {
-  int fstdin, fstdout, fstderr;
+  int  fstdin, fstdout, fstderr;
+  int  sync[2];
+  char c;
+  struct timespec now;
 
 
-  signal( SIGUSR1, execute_done );
+  /* Closed by the child once it has the tty, when it executes "cmd" */
+  if(  pipe2( sync, O_CLOEXEC ) < 0  ) {
+    perror("execute(): pipe");
+    exit( 1 );
+  }
 
   if(  (execPID = fork()) == -1  ) {
     perror("execute(): fork");
@@ -560,6 +684,8 @@ void execute( char** cmd ) {
   }
 
   if( execPID == CHILD ) {
+    close( sync[0] );
+
     /* save copies in case exec fails */
     fstdin  = dup(0);
     fstdout = dup(1);
@@ -579,8 +705,7 @@ void execute( char** cmd ) {
       signal( SIGTSTP, SIG_IGN );
     }
 
-    /* Better be setup to handle a SIGUSR1 */
-    kill( getppid(), SIGUSR1 );
+    sigprocmask( SIG_SETMASK, &oldmask, NULL );
 
     execvp( cmd[0], cmd );
 
@@ -599,9 +724,23 @@ void execute( char** cmd ) {
   }
 
 
-  while( executing ); /* let child run until it gives signal */
+#ifdef SYS_pidfd_open
+  pidfd = syscall( SYS_pidfd_open, execPID, 0 );
+#endif
+
+  /* kill it when the run is over the limit, counted from here */
+  if( flagT > 0 ) {
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    arm( capfd, &now, flagT );
+  }
+
+  /* let child run until it has the tty */
+  close( sync[1] );
+
+  while(  read( sync[0], &c, 1 ) < 0 && errno == EINTR  )
+    ;
 
-  usleep( flagw );
+  close( sync[0] );
 
 #ifdef DEBUG
   fprintf( stderr, "ptyjig: execPID = %d\n", execPID );
@@ -611,75 +750,390 @@ void execute( char** cmd ) {
 
 
 /* 
- *  Sleeps for 1 second, then KILLs PID execPID using SIGKILL
+ * Give execPID 1 second to die naturally, after which "quietfd" KILLs
+ * it using SIGKILL
  */
-void reader_done(int sig) {
-  sleep( 1 );   /* Let execPID die naturally */
+void reader_done() {
+  struct timespec now;
+
+
+  if( !dying ) {
+    dying = TRUE;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    arm( quietfd, &now, NSEC );
+    return;
+  }
 
 #ifdef DEBUG
   fprintf( stderr, "ptyjig: killing execPID = %d\n", execPID );
 #endif
 
-  kill( execPID, SIGKILL ); /* If it doesn't die on its own, kill it */
+  killcmd( SIGKILL ); /* If it doesn't die on its own, kill it */
+}
+
+
+
+/*
+ * "quietfd" went off.  The output of "cmd" does not re-arm it, but
+ * only says when it came, so the timer may go off early: then it is
+ * armed again for "flagt" after the last output.
+ */
+void quiet() {
+  struct timespec now;
+  long long       ns;
+
+
+  if( dying ) {
+    reader_done();
+    return;
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  ns = (now.tv_sec - heard.tv_sec) * NSEC + (now.tv_nsec - heard.tv_nsec);
+
+  if( ns < flagt ) {
+    arm( quietfd, &heard, flagt );
+    return;
+  }
+
+  reader_done();
 }
 
 
 
 /*
- * Sets boolean to false to stop writer
+ * Stdin or the ring is exhausted and the EOF char sent: exit if "cmd"
+ * sends no more output for "flagt" nanoseconds
  */
-void writer_done( int sig ) {
+void writer_done() {
   writing = FALSE;
-  ualarm(flagt, 0);
+
+  if( flagv ) {
+    pace_report( &pace, stderr, "ptyjig" );
+
+    if( dropped ) {
+      fprintf( stderr, "ptyjig: %lld bytes held back from full lines\n", dropped );
+    }
+  }
+
+#ifdef DEBUG
+  fprintf( stderr, "ptyjig: writer finished\n" );
+#endif
+
+  if( !dying && flagt > 0 ) {
+    clock_gettime( CLOCK_MONOTONIC, &heard );
+    arm( quietfd, &heard, flagt );
+  }
+}
+
+
+
+/*
+ * Wait on the ring for the loop, which cannot wait on it itself.  Each
+ * piece is handed over through "ringfd", and handed back through
+ * "backfd" once all of it is sent.  A piece of 0 is the end.
+ */
+void* ringwaiter( void* arg ) {
+  uint64_t one = 1;
+
+
+  (void) arg;
+
+  do {
+    nringkeys = ring_peek( &ring, &ringkeys );
+
+    (void) write( ringfd, &one, sizeof(one) );
+
+    if( nringkeys > 0 ) {
+      (void) read( backfd, &one, sizeof(one) );
+      ring_consume( &ring, nringkeys );
+    }
+  } while( nringkeys > 0 );
+
+  return( NULL );
+}
+
+
+
+/*
+ * Next keystrokes, from stdin or from the ring, into "keys".  Returns
+ * 1 if there are some, 0 if there are none yet and -1 at the end.
+ */
+int getkeys() {
+  ssize_t n;
+
+
+  if( flagq != NULL ) {
+    if( !ringready ) {
+      return( 0 );
+    }
+
+    ringready = FALSE;
+
+    if( nringkeys <= 0 ) {
+      pthread_join( ringer, NULL );
+      ring_close( &ring );
+      return( -1 );
+    }
+
+    keys  = ringkeys;
+    nkeys = nringkeys;
+    return( 1 );
+  }
+
+  if( !inready ) {
+    return( 0 );
+  }
+
+  inready = !stdinpoll;
+
+  while(  (n = read( 0, inbuf, sizeof(inbuf) )) < 0 && errno == EINTR  )
+    ;
+
+  if( n <= 0 ) {
+    return( -1 );
+  }
+
+  keys  = inbuf;
+  nkeys = n;
+  return( 1 );
+}
+
+
+
+/*
+ * No more keystrokes: what is left to send is the EOF char, if any
+ */
+void endkeys() {
+  if( !sendeof && flage ) {
+    keys  = &flage;
+    nkeys = 1;
+  }
+  else {
+    nkeys = 0;
+  }
+
+  sendeof = TRUE;
 }
 
 
 
 /*
- * Read from stdin and send everything character read to "pty".  Record the
- * keystrokes in "filei" if -i flag is on. 
+ * Is the tty of "cmd" in canonical mode?  On a pty master, tcgetattr()
+ * gets the mode of the slave.
+ */
+int cooked() {
+  if(  tcgetattr( pty, &slave ) == 0 && (slave.c_lflag & ICANON)  ) {
+    return( TRUE );
+  }
+
+  linelen = 0;
+  lnext   = FALSE;
+  return( FALSE );
+}
+
+
+
+/*
+ * Is "c" the special character "i" of the tty of "cmd"?
+ */
+#define SPECIAL(c, i)  ((c) == slave.c_cc[i] && slave.c_cc[i] != _POSIX_VDISABLE)
+
+/*
+ * How many of the "n" keystrokes at "p" a "cmd" in canonical mode gets
+ * in one piece: the line discipline drops what goes past the end of
+ * its line buffer, and what is still to come of a line cannot be read
+ * before the end of it, so no waiting makes room for it.  With "sent",
+ * all "n" are taken as sent, and the line is followed through them.
+ */
+ssize_t canon( char* p, ssize_t n, int sent ) {
+  unsigned char c;
+  ssize_t       i;
+  int           len = linelen;
+  int           lit = lnext;
+
+
+  for( i = 0 ; i < n ; i++ ) {
+    c = p[i];
+
+    if( lit ) {
+      lit = FALSE;
+    }
+    else if(  (slave.c_lflag & IEXTEN) && SPECIAL(c, VLNEXT)  ) {
+      lit = TRUE;
+      continue;
+    }
+    else if(  c == '\n' || SPECIAL(c, VEOL) || SPECIAL(c, VEOL2) || SPECIAL(c, VEOF) ||
+              (c == '\r' && (slave.c_iflag & (ICRNL | IGNCR)) == ICRNL) || SPECIAL(c, VKILL) ||
+              ((slave.c_lflag & ISIG) && !(slave.c_lflag & NOFLSH) &&
+               (SPECIAL(c, VINTR) || SPECIAL(c, VQUIT) || SPECIAL(c, VSUSP)))  ) {
+      len = 0;
+      continue;
+    }
+    else if(  c == '\r' && (slave.c_iflag & IGNCR)  ) {
+      continue;
+    }
+    else if(  SPECIAL(c, VERASE) || ((slave.c_lflag & IEXTEN) && SPECIAL(c, VWERASE))  ) {
+      len -= len > 0;
+      continue;
+    }
+
+    if( len >= CANON_MAX && !sent ) {
+      return( i );
+    }
+
+    len++;
+  }
+
+  if( sent ) {
+    linelen = len;
+    lnext   = lit;
+  }
+
+  return( n );
+}
+
+
+
+/*
+ * Hand a piece of the ring back once all of it is sent
+ */
+void giveback() {
+  uint64_t one = 1;
+
+
+  if( nkeys == 0 && flagq != NULL ) {
+    (void) write( backfd, &one, sizeof(one) );
+  }
+}
+
+
+
+/*
+ * Record "n" keystrokes in "filei": do not send '\r', send '\n' instead
+ */
+int record( char* p, ssize_t n ) {
+  char*   r;
+  ssize_t k;
+
+
+  while( n > 0 ) {
+    k = n < (ssize_t) sizeof(recbuf) ? n : (ssize_t) sizeof(recbuf);
+    memcpy( recbuf, p, k );
+
+    for( r = recbuf ; (r = memchr( r, '\r', recbuf + k - r )) != NULL ; ) {
+      *r++ = '\n';
+    }
+
+    if(  write( fileno(filei), recbuf, k ) != k  ) {
+      return( -1 );
+    }
+
+    p += k;
+    n -= k;
+  }
+
+  return( 0 );
+}
+
+
+
+/*
+ * Send keystrokes to "pty" for as long as there are some, "pty" takes
+ * them and the pacing lets us: as many as "pty" takes at a time, or the
+ * rest of a burst with -d or -c.  Record the keystrokes in "filei" if
+ * -i flag is on. 
  */
 void writer() {
-  char c;
+  struct epoll_event ev;
+  struct timespec    due;
+  ssize_t            n, k;
+  int                canonical;
 
 
-  /*
-   * Read from keyboard continuously and send it to "pty" 
-   */
-  while( read(0, &c, 1) == 1 ) { 
-    if( write(pty, &c, 1) != 1 ) {
-      break;
+  while( writing && !paused && !full ) {
+    if( nkeys == 0 ) {
+      if( sendeof ) {
+        writer_done();
+        return;
+      }
+
+      if(  (n = getkeys()) == 0  ) {
+        return;
+      }
+
+      if( n < 0 ) {
+        endkeys();
+        continue;
+      }
+    }
+
+    n = nkeys;
+
+    if( pace.rate > 0 && n > pace.burst - pace.pending ) {
+      n = pace.burst - pace.pending;
     }
 
-    if (flagi) {
-      /* Do not send '\r', send '\n' instead */
-      if( c == '\r' ) {
-        c = '\n';
+    /* Hold back, and do not record, what a full line would drop */
+    if(  (canonical = !sendeof && cooked())  ) {
+      if(  (n = canon( keys, n, FALSE )) == 0  ) {
+        while(  nkeys > 0 && canon( keys, 1, FALSE ) == 0  ) {
+          keys++;
+          nkeys--;
+          dropped++;
+        }
+
+        giveback();
+        continue;
       }
+    }
 
-      if(  write( fileno(filei), &c, 1 ) != 1  ) {
-        perror( namei );
-        break;
+    if(  (k = write( pty, keys, n )) < 0 && errno == EINTR  ) {
+      continue;
+    }
+
+    if( k < 0 && errno != EAGAIN ) {
+      endkeys();
+      continue;
+    }
+
+    /* Wait for "pty" to take more */
+    if( k < n ) {
+      full       = TRUE;
+      ev.events  = EPOLLIN | EPOLLOUT;
+      ev.data.fd = pty;
+      epoll_ctl( epfd, EPOLL_CTL_MOD, pty, &ev );
+
+      if( k <= 0 ) {
+        return;
       }
     }
 
-    /* Delay writing to "pty" if flagged */
-    if( flagd ) {
-      usleep( flagd );
+    if( canonical ) {
+      canon( keys, k, TRUE );
     }
-  }
 
-  if( flage ) {
-    (void)write( pty, &flage, 1 );
-  }
+    keys  += k;
+    nkeys -= k;
 
-#ifdef DEBUG
-  fprintf( stderr, "ptyjig: writer finished\n" );
-#endif
+    if( sendeof ) {
+      continue;
+    }
 
-  kill( readerPID, SIGUSR1 ); /* tell reader to quit if no more char from exec */
+    if(  flagi && record( keys - k, k ) < 0  ) {
+      perror( namei );
+      endkeys();
+      continue;
+    }
+
+    giveback();
 
-  while( 1 );  /* XXX: INFINITE LOOP: Wait until parent kills me */
+    /* Delay writing to "pty" if flagged */
+    if(  pace_count( &pace, k, &due )  ) {
+      arm( pacefd, &due, 0 );
+      paused = TRUE;
+    }
+  }
 }
 
 
@@ -689,76 +1143,242 @@ void writer() {
  */
 void reader() {
   char    c[BUFSIZ];
-  int     i;
+  ssize_t i;
 
 
   /*
-   * Continuously read from "pty" until exhausted.  Write every character
-   * to stdout if -x flag is not present, and to "fileo" if -o flag is on.   
+   * Write what "pty" has to stdout if -x flag is not present, and to
+   * "fileo" if -o flag is on.   
    */
-  signal( SIGALRM, reader_done );
-  signal( SIGUSR1, writer_done );
+  if(  (i = read( pty, c, sizeof(c) )) < 0 && (errno == EAGAIN || errno == EINTR)  ) {
+    return;
+  }
 
-  while ((i = read(pty, c, sizeof(c))) > 0) {
-    if( !flagx ) {
-      if( write(1, c, i) != i ) {
-        exit( 1 );
-      }
+  if( i <= 0 ) {
+#ifdef DEBUG
+    fprintf( stderr, "ptyjig: reader finished\n" );
+#endif
+
+    epoll_ctl( epfd, EPOLL_CTL_DEL, pty, NULL );
+    reader_done();
+    return;
+  }
+
+  if( !flagx ) {
+    if( write(1, c, i) != i ) {
+      exit( 1 );
     }
+  }
 
-    if( flago ) {
-      if(  write( fileno(fileo), c, i ) != i  ) {
-        perror( nameo );
-        exit( 1 );
-      }
+  if( flago ) {
+    if(  write( fileno(fileo), c, i ) != i  ) {
+      perror( nameo );
+      exit( 1 );
     }
+  }
+
+  /*
+   * The following "if" essentially means when "writer" is done, and
+   * there is no more keystroke coming from "pty" wait for "flagt"
+   * seconds and quit.  If during this wait, a character comes from
+   * "pty", then the wait is set back, by quiet() when it is over. 
+   */
+  if( !writing && !dying ) {
+    clock_gettime( CLOCK_MONOTONIC, &heard );
+  }
+}
+
+
+
+/*
+ * Take the signals that came in through "sigfd"
+ */
+void signals() {
+  struct signalfd_siginfo si;
+
+
+  while(  read( sigfd, &si, sizeof(si) ) == sizeof(si)  ) {
+    switch( si.ssi_signo ) {
+      case SIGCHLD:
+        child();
+        break;
+
+      case SIGWINCH:
+        sigwinch();
+        break;
 
-    /*
-     * The following "if" essentially means when "writer" is done, and
-     * there is no more keystroke coming from "pty" wait for "flagt"
-     * seconds and quit.  If during this wait, a character comes from
-     * "pty", then the wait is set back. 
-     */
-    if( !writing ) {
-      ualarm( flagt, 0 );
+      default:
+        clean_sig( si.ssi_signo );
     }
   }
+}
 
-#ifdef DEBUG
-  fprintf( stderr, "ptyjig: reader finished\n" );
-#endif
 
-  reader_done( 0 );
+
+/*
+ * Watch "fd" for "events" in the loop
+ */
+int watch( int fd, unsigned events ) {
+  struct epoll_event ev;
+
+
+  ev.events  = events;
+  ev.data.fd = fd;
+
+  return( epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &ev ) );
 }
 
 
 
 /*
- * WHY?
+ * Block the signals we handle, to take them through "sigfd" instead,
+ * and make the event loop.  "cmd" gets the old mask back.
  */
-void doreader() {
-  reader();
+void setup_loop() {
+  sigset_t mask;
+
+
+  sigemptyset( &mask );
+  sigaddset( &mask, SIGCHLD  );
+  sigaddset( &mask, SIGWINCH );
+  sigaddset( &mask, SIGINT   );
+  sigaddset( &mask, SIGQUIT  );
+  sigaddset( &mask, SIGTERM  );
+  sigprocmask( SIG_BLOCK, &mask, &oldmask );
+
+  if(  (sigfd = signalfd( -1, &mask, SFD_NONBLOCK | SFD_CLOEXEC )) < 0  ||
+       (epfd = epoll_create1( EPOLL_CLOEXEC )) < 0  ||
+       (pacefd  = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC )) < 0  ||
+       (quietfd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC )) < 0  ||
+       (capfd   = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC )) < 0  ) {
+    perror( "ptyjig" );
+    exit( 1 );
+  }
+
+  fcntl( pty, F_SETFD, FD_CLOEXEC );
+
+  watch( sigfd,  EPOLLIN );
+  watch( pacefd,  EPOLLIN );
+  watch( quietfd, EPOLLIN );
+  watch( capfd,   EPOLLIN );
+
+  if( flagq != NULL ) {
+    if(  (ringfd = eventfd( 0, EFD_CLOEXEC )) < 0  ||
+         (backfd = eventfd( 0, EFD_CLOEXEC )) < 0  ||
+         pthread_create( &ringer, NULL, ringwaiter, NULL ) != 0  ) {
+      perror( "ptyjig" );
+      exit( 1 );
+    }
+
+    watch( ringfd, EPOLLIN );
+  }
 }
 
 
 
 /*
- * Fork writer 
+ * Move keystrokes from stdin or the ring to "pty", and the output of
+ * "cmd" from "pty" to stdout, until "cmd" is gone.  Nothing here waits
+ * but epoll_wait().
  */
-void dowriter() {
-  if(  (writerPID = fork()) == -1  ) {
-    perror("dowriter(): fork:");
-    exit(1);
-  } 
+void loop() {
+  struct epoll_event ev[8];
+  struct timespec    now;
+  uint64_t           n;
+  int                i, k;
+
+
+  fcntl( pty, F_SETFL, fcntl(pty, F_GETFL) | O_NONBLOCK );
+  watch( pty, EPOLLIN );
+
+  /* -w holds the writer back as pacing does, on "pacefd" */
+  if( flagw > 0 ) {
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    arm( pacefd, &now, flagw * 1000LL );
+    paused = TRUE;
+  }
+
+  /* Readable once "cmd" has exited; stops still come with SIGCHLD */
+  if( pidfd >= 0 ) {
+    watch( pidfd, EPOLLIN );
+  }
+
+  /* A file is always ready, and epoll will not have it */
+  if( flagq == NULL ) {
+    if(  watch( 0, EPOLLIN ) < 0  ) {
+      stdinpoll = FALSE;
+      inready   = TRUE;
+    }
+    else {
+      inwatch = TRUE;
+    }
+  }
 
-  if( writerPID == CHILD ) {
-    writerPID = getpid();
+  for( ;; ) {
     writer();
+
+    /* Only ask for stdin when there is room for it; a pipe at its end
+       is reported whatever is asked for, so take it out altogether */
+    if(  stdinpoll && flagq == NULL && inwatch != (writing && !inready)  ) {
+      inwatch = !inwatch;
+
+      if( inwatch ) {
+        watch( 0, EPOLLIN );
+      }
+      else {
+        epoll_ctl( epfd, EPOLL_CTL_DEL, 0, NULL );
+      }
+    }
+
+    if(  (k = epoll_wait( epfd, ev, 8, -1 )) < 0  ) {
+      if( errno == EINTR ) {
+        continue;
+      }
+
+      perror( "ptyjig: epoll_wait" );
+      clean();
+      exit( 1 );
+    }
+
+    for( i = 0 ; i < k ; i++ ) {
+      if( ev[i].data.fd == sigfd ) {
+        signals();
+      }
+      else if( ev[i].data.fd == pty ) {
+        if( ev[i].events & EPOLLOUT ) {
+          full         = FALSE;
+          ev[i].events = EPOLLIN;
+          epoll_ctl( epfd, EPOLL_CTL_MOD, pty, &ev[i] );
+        }
+
+        if( ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) ) {
+          reader();
+        }
+      }
+      else if( ev[i].data.fd == pidfd ) {
+        child();
+      }
+      else if( ev[i].data.fd == 0 ) {
+        inready = TRUE;
+      }
+      else if( ev[i].data.fd == ringfd ) {
+        (void) read( ringfd, &n, sizeof(n) );
+        ringready = TRUE;
+      }
+      else if( ev[i].data.fd == pacefd ) {
+        (void) read( pacefd, &n, sizeof(n) );
+        paused = FALSE;
+      }
+      else if( ev[i].data.fd == quietfd ) {
+        (void) read( quietfd, &n, sizeof(n) );
+        quiet();
+      }
+      else if( ev[i].data.fd == capfd ) {
+        (void) read( capfd, &n, sizeof(n) );
+        killcmd( SIGKILL );
+      }
+    }
   }
-     
-#ifdef DEBUG
-  fprintf( stderr, "ptyjig: writerPID = %d\n", writerPID );
-#endif
 }
 
 
@@ -783,9 +1403,15 @@ void usage() {
   printf("    -i FILEIN   standard input saved to file FILEIN\n");
   printf("    -o FILEOUT  standard output saved to file FILEOUT\n");
   printf("    -d DELAY    use a keystroke delay of DELAY seconds (accepts floating pt)\n");
+  printf("    -c RATE     send RATE keystrokes per second\n");
+  printf("    -B BURST    with -d or -c, send BURST keystrokes between waits\n");
+  printf("    -v          report the keystroke rate achieved with -d or -c\n");
   printf("    -t TIMEOUT  kill \"cmd\" if stdin exhausted and \"cmd\" doesn't send\n");
-  printf("                output for TIMEOUT seconds\n");
-  printf("    -w WAIT     wait WAIT seconds before streaming input to \"cmd\"\n\n");
+  printf("                output for TIMEOUT seconds (0 for never)\n");
+  printf("    -T LIMIT    kill \"cmd\" LIMIT seconds after it started\n");
+  printf("    -w WAIT     wait WAIT seconds before streaming input to \"cmd\"\n");
+  printf("    -q NAME     take the input from the ring of \"fuzz -q NAME\"\n");
+  printf("                instead of stdin\n\n");
   printf("  Defaults:\n");
   printf("    -i /dev/null -o /dev/null -d 0 -t 2\n\n");
   printf("  Examples:\n\n");
@@ -814,6 +1440,8 @@ int main( int argc, char** argv ) {
   int     num;
   int     cont;
   float   f;
+  double  secs;
+  long long ns;
   extern int   optind;
   extern char* optarg;
 
@@ -842,6 +1470,10 @@ int main( int argc, char** argv ) {
           flagx = TRUE;
           break;
 
+        case 'v':
+          flagv = TRUE;
+          break;
+
         case 'i':
           flagi = TRUE;
           namei = argv[2];
@@ -850,6 +1482,17 @@ int main( int argc, char** argv ) {
           cont = FALSE;
           break;
 
+        case 'q':
+          if( argv[2] == NULL ) {
+            usage();
+          }
+
+          flagq = argv[2];
+          argc--;
+          argv++;
+          cont = FALSE;
+          break;
+
         case 'o':
           flago = TRUE;
           nameo = argv[2];
@@ -867,21 +1510,48 @@ int main( int argc, char** argv ) {
           argv++;
           cont = FALSE;
   
-          /* Convert to microseconds */
-          flagd = (unsigned)(f * 1000000.0);
+          flagd = f;
           break;
 
-        case 't':
-          if(  sscanf( argv[2], "%f", &f ) < 1  ) {
+        case 'c':
+          if(  sscanf( argv[2], "%lf", &flagc ) < 1 || flagc < 0  ) {
             usage();
           }
 
           argc--;
           argv++;
           cont = FALSE;
+          break;
 
-          /* Convert to microseconds */
-          flagt = (unsigned)(f * 1000000.0);
+        case 'B':
+          if(  sscanf( argv[2], "%ld", &flagB ) < 1 || flagB <= 0  ) {
+            usage();
+          }
+
+          argc--;
+          argv++;
+          cont = FALSE;
+          break;
+
+        case 't':
+        case 'T':
+          if(  sscanf( argv[2], "%lf", &secs ) < 1 || secs < 0  ) {
+            usage();
+          }
+
+          /* Convert to nanoseconds, up to some 285 years */
+          ns = secs < 9e9 ? (long long)(secs * NSEC) : 9 * NSEC * NSEC;
+
+          if( argv[1][num] == 't' ) {
+            flagt = ns;
+          }
+          else {
+            flagT = ns;
+          }
+
+          argc--;
+          argv++;
+          cont = FALSE;
           break;
 
         case 'w':
@@ -918,6 +1588,13 @@ int main( int argc, char** argv ) {
     usage();
   }
 
+  /* Keystroke pacing */
+  if( flagc == 0 && flagd > 0 ) {
+    flagc = 1.0 / flagd;
+  }
+
+  pace_init( &pace, flagc, flagB );
+
   /* Possibly open a "save the input file"  */
   if( flagi ) {
     filei = fopen( namei, "wb" );
@@ -938,6 +1615,14 @@ int main( int argc, char** argv ) {
     }
   }
 
+  /* Wait for fuzz to make the input ring */
+  if( flagq != NULL ) {
+    if(  ring_attach( &ring, flagq ) < 0  ) {
+      perror(flagq);
+      exit(1);
+    }
+  }
+
 
 #ifdef SOLARIS
   /* get attribute info about /dev/tty */
@@ -960,31 +1645,22 @@ int main( int argc, char** argv ) {
   (void) tcsetattr( pty, TCSANOW, &termIOSettings );
 #endif
 
-  signal( SIGCHLD, sigchld ); 
+  /* take signals, stdin or the ring through one loop */
+  setup_loop();
 
   /* fork and execute test program with arguments */
   progname = argv[1]; 
   execute( (char **) &argv[1] );
 
+
 #ifdef SOLARIS
   /* setup the tty to be RAW, CBREAK, and not ECHO */
   fixtty();
 #endif
 
-  signal( SIGWINCH, sigwinch ); 
-
-  readerPID = getpid(); 
-
-  dowriter();
-
-  /* put here instead of above to avoid invoking clean_XYZ twice */
-  signal( SIGQUIT, clean_quit ); 
-  signal( SIGTERM, clean_term ); 
-  signal( SIGINT,  clean_int  ); 
-
-  doreader();
+  loop();
 
-  while( 1 );  /* XXX: INFINITE LOOP: Wait for SIGCHLD to make us exit */
+  return( 0 );
 }
 
 
@@ -0,0 +1,403 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  A ring buffer in named shared memory, see ring.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ring.h"
+
+#define RING_MAGIC 0x676e6972   /* "ring" */
+#define RING_DATA  4096         /* Offset of the data, after the header */
+#define RING_NAP   100          /* ms asleep before looking for the other side */
+
+#define TRUE  1
+#define FALSE 0
+
+
+static int  shmname(const char *name, char *path, size_t size);
+static int  ready(struct ring *r);
+static int  alive(int32_t pid);
+static int  sleepon(struct ring *r, uint32_t *seq, uint32_t *flag);
+static void wake(uint32_t *seq, uint32_t *flag);
+static void nap(int ms);
+static long long msnow(void);
+
+
+/*
+ * Make the ring "name" and attach to it as the writer.  A ring of
+ * that name left over from an earlier run is replaced.  Returns -1
+ * with errno set on failure.
+ */
+int ring_create( struct ring *r, const char *name ) {
+  char path[256];
+  int  fd;
+
+
+  if( shmname(name, path, sizeof(path)) < 0 ) {
+    return( -1 );
+  }
+
+  (void) shm_unlink( path );
+
+  if( (fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0 ) {
+    return( -1 );
+  }
+
+  r->maplen = RING_DATA + RING_SIZE;
+
+  if( ftruncate(fd, r->maplen) < 0 ||
+      (r->h = mmap(NULL, r->maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0)) == MAP_FAILED ) {
+    (void) close( fd );
+    (void) shm_unlink( path );
+    return( -1 );
+  }
+
+  (void) close( fd );
+
+  strcpy( r->path, path );
+  r->born    = msnow();
+  r->data    = (char *) r->h + RING_DATA;
+  r->mask    = RING_SIZE - 1;
+  r->writer  = TRUE;
+  r->h->size = RING_SIZE;
+  r->h->wpid = getpid();
+  __atomic_store_n( &r->h->magic, RING_MAGIC, __ATOMIC_RELEASE );
+
+  return( 0 );
+}
+
+
+/*
+ * Attach to the ring "name" as the reader, waiting up to RING_WAIT ms
+ * for the writer to make it, and remove the name.  Returns -1 with
+ * errno set on failure.
+ */
+int ring_attach( struct ring *r, const char *name ) {
+  struct stat st;
+  char        path[256];
+  int         fd = -1, ms;
+
+
+  if( shmname(name, path, sizeof(path)) < 0 ) {
+    return( -1 );
+  }
+
+  for( ms = 0 ; ; ms += 10 ) {
+    if( fd < 0 && (fd = shm_open(path, O_RDWR, 0)) < 0 && errno != ENOENT ) {
+      return( -1 );
+    }
+
+    if( fd >= 0 && fstat(fd, &st) < 0 ) {
+      (void) close( fd );
+      return( -1 );
+    }
+
+    if( fd >= 0 && st.st_size >= RING_DATA ) {
+      break;
+    }
+
+    if( ms >= RING_WAIT ) {
+      errno = ENOENT;
+      return( -1 );
+    }
+
+    nap( 10 );
+  }
+
+  r->maplen = st.st_size;
+  r->h      = mmap(NULL, r->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  (void) close( fd );
+
+  if( r->h == MAP_FAILED ) {
+    return( -1 );
+  }
+
+  for( ; __atomic_load_n(&r->h->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ; ms += 10 ) {
+    if( ms >= RING_WAIT ) {
+      (void) munmap( r->h, r->maplen );
+      errno = EINVAL;
+      return( -1 );
+    }
+
+    nap( 10 );
+  }
+
+  if( r->h->size == 0 || (r->h->size & (r->h->size - 1)) != 0 ||
+      RING_DATA + (size_t) r->h->size > r->maplen ) {
+    (void) munmap( r->h, r->maplen );
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  r->data   = (char *) r->h + RING_DATA;
+  r->mask   = r->h->size - 1;
+  r->writer = FALSE;
+  __atomic_store_n( &r->h->rpid, getpid(), __ATOMIC_RELEASE );
+  (void) shm_unlink( path );
+
+  return( 0 );
+}
+
+
+/*
+ * Copy the "n" bytes at "p" into the ring, waiting for room as long
+ * as needed.  Returns -1 with errno EPIPE if the reader went away.
+ */
+int ring_write( struct ring *r, const char *p, size_t n ) {
+  struct ringhdr *h = r->h;
+  uint64_t        head, tail;
+  size_t          k;
+
+
+  while( n > 0 ) {
+    head = h->head;
+    tail = __atomic_load_n( &h->tail, __ATOMIC_ACQUIRE );
+
+    if( head - tail == h->size ) {
+      if( sleepon(r, &h->rseq, &h->wwait) < 0 ) {
+        errno = EPIPE;
+        return( -1 );
+      }
+      continue;
+    }
+
+    k = h->size - (head - tail);
+    k = n < k ? n : k;
+
+    if( k > h->size - (head & r->mask) ) {
+      k = h->size - (head & r->mask);
+    }
+
+    memcpy( r->data + (head & r->mask), p, k );
+    __atomic_store_n( &h->head, head + k, __ATOMIC_RELEASE );
+    wake( &h->wseq, &h->rwait );
+
+    p += k;
+    n -= k;
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Point "p" at the next bytes in the ring, waiting for some as long
+ * as needed, and return how many there are in one piece.  They stay
+ * in the ring until ring_consume().  Returns 0 at the end.
+ */
+ssize_t ring_peek( struct ring *r, char **p ) {
+  struct ringhdr *h = r->h;
+  uint64_t        head, tail;
+  size_t          k;
+
+
+  for( ;; ) {
+    tail = h->tail;
+    head = __atomic_load_n( &h->head, __ATOMIC_ACQUIRE );
+
+    if( head != tail ) {
+      k = head - tail;
+
+      if( k > h->size - (tail & r->mask) ) {
+        k = h->size - (tail & r->mask);
+      }
+
+      *p = r->data + (tail & r->mask);
+      return( (ssize_t) k );
+    }
+
+    /* The last bytes are in before the writer says it is done */
+    if( __atomic_load_n(&h->closed, __ATOMIC_ACQUIRE) ) {
+      if( __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) == tail ) {
+        return( 0 );
+      }
+      continue;
+    }
+
+    if( sleepon(r, &h->wseq, &h->rwait) < 0 ) {
+      return( 0 );
+    }
+  }
+}
+
+
+/*
+ * Give the first "n" bytes in the ring back to the writer
+ */
+void ring_consume( struct ring *r, size_t n ) {
+  __atomic_store_n( &r->h->tail, r->h->tail + n, __ATOMIC_RELEASE );
+  wake( &r->h->rseq, &r->h->wwait );
+}
+
+
+/*
+ * Tell the other side this one is done, and detach
+ */
+void ring_close( struct ring *r ) {
+  if( r->h == NULL ) {
+    return;
+  }
+
+  if( r->writer ) {
+    __atomic_store_n( &r->h->closed, 1, __ATOMIC_RELEASE );
+    wake( &r->h->wseq, &r->h->rwait );
+
+    /* No reader ever came to remove the name */
+    if( __atomic_load_n(&r->h->rpid, __ATOMIC_ACQUIRE) == 0 ) {
+      (void) shm_unlink( r->path );
+    }
+  }
+  else {
+    __atomic_store_n( &r->h->gone, 1, __ATOMIC_RELEASE );
+    wake( &r->h->rseq, &r->h->wwait );
+  }
+
+  (void) munmap( r->h, r->maplen );
+  r->h = NULL;
+}
+
+
+/*
+ * The shared memory name of the ring "name": "/name"
+ */
+static int shmname( const char *name, char *path, size_t size ) {
+  if( *name == '/' ) {
+    name++;
+  }
+
+  if( *name == 0 || strchr(name, '/') != NULL ||
+      snprintf(path, size, "/%s", name) >= (int) size ) {
+    errno = EINVAL;
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Can this side go on: is there room for the writer, data for the
+ * reader, or is the other side done?
+ */
+static int ready( struct ring *r ) {
+  struct ringhdr *h = r->h;
+
+
+  if( r->writer ) {
+    return( __atomic_load_n(&h->gone, __ATOMIC_ACQUIRE) ||
+            h->head - __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE) < h->size );
+  }
+
+  return( __atomic_load_n(&h->closed, __ATOMIC_ACQUIRE) ||
+          __atomic_load_n(&h->head, __ATOMIC_ACQUIRE) != h->tail );
+}
+
+
+/*
+ * Is process "pid" still there?  0, not attached yet, counts as yes.
+ */
+static int alive( int32_t pid ) {
+  return( pid == 0 || kill(pid, 0) == 0 || errno != ESRCH );
+}
+
+
+/*
+ * Sleep until the other side bumps "seq", having said so in "flag".
+ * The flag is raised before the last look at the ring, and the other
+ * side looks at the flag after its last change to the ring, so one
+ * of the two sees the other.  Returns -1 if the other side is gone
+ * without saying so, or if the writer has waited RING_WAIT ms for a
+ * reader that never attached.
+ */
+static int sleepon( struct ring *r, uint32_t *seq, uint32_t *flag ) {
+  uint32_t s;
+  int32_t  pid;
+#ifdef __linux__
+  struct timespec t;
+#endif
+
+
+  s = __atomic_load_n( seq, __ATOMIC_ACQUIRE );
+  __atomic_store_n( flag, 1, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+  if( !ready(r) ) {
+    pid = __atomic_load_n( r->writer ? &r->h->rpid : &r->h->wpid, __ATOMIC_ACQUIRE );
+
+    if( !alive(pid) ||
+        (r->writer && pid == 0 && msnow() - r->born >= RING_WAIT) ) {
+      __atomic_store_n( flag, 0, __ATOMIC_RELAXED );
+      return( -1 );
+    }
+
+#ifdef __linux__
+    t.tv_sec  = 0;
+    t.tv_nsec = RING_NAP * 1000000L;
+    (void) syscall( SYS_futex, seq, FUTEX_WAIT, s, &t, NULL, 0 );
+#else
+    nap( 1 );
+#endif
+  }
+
+  __atomic_store_n( flag, 0, __ATOMIC_RELAXED );
+
+  return( 0 );
+}
+
+
+/*
+ * Wake the other side if it sleeps on "seq"
+ */
+static void wake( uint32_t *seq, uint32_t *flag ) {
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+  if( __atomic_load_n(flag, __ATOMIC_RELAXED) ) {
+    __atomic_store_n( flag, 0, __ATOMIC_RELAXED );
+    __atomic_add_fetch( seq, 1, __ATOMIC_RELEASE );
+
+#ifdef __linux__
+    (void) syscall( SYS_futex, seq, FUTEX_WAKE, 1, NULL, NULL, 0 );
+#endif
+  }
+}
+
+
+static long long msnow( void ) {
+  struct timespec t;
+
+
+  (void) clock_gettime( CLOCK_MONOTONIC, &t );
+  return( t.tv_sec * 1000LL + t.tv_nsec / 1000000 );
+}
+
+
+static void nap( int ms ) {
+  struct timespec t;
+
+
+  t.tv_sec  = ms / 1000;
+  t.tv_nsec = (ms % 1000) * 1000000L;
+  (void) nanosleep( &t, NULL );
+}
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  A ring buffer in named shared memory, from fuzz to ptyjig
+ *
+ *  One writer (fuzz -q NAME) copies its output into the ring and one
+ *  reader (ptyjig -q NAME) takes it straight from there: no pipe, no
+ *  copy into the kernel and back, and no system call at all while
+ *  neither side has to wait.  A side that has to wait sleeps on a
+ *  futex in the ring, and is woken by the other once there is data or
+ *  room; the writer runs ahead of the reader by at most the size of
+ *  the ring.
+ *
+ *  The writer makes the ring, as /dev/shm/NAME; the reader waits for
+ *  it to appear, and removes the name once it is attached.  If either
+ *  side goes away, the other sees end of file (the reader) or EPIPE
+ *  (the writer).  Each side waits RING_WAIT ms for the other to come
+ *  at all: the writer also sees EPIPE if no reader has attached by
+ *  then and it has to wait for room.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RING_SIZE  (4 << 20)    /* Bytes of data in a ring */
+#define RING_WAIT  10000        /* ms either side waits for the other */
+
+/*
+ * The shared part.  Each side writes its own cache line only, but
+ * for the flag saying that the other is asleep.
+ */
+struct ringhdr {
+  uint32_t magic;               /* Set last, once the ring is ready */
+  uint32_t size;
+  int32_t  wpid, rpid;          /* Writer, reader (0 until attached) */
+  uint32_t closed;              /* The writer is done */
+  uint32_t gone;                /* The reader is done */
+  char     pad0[40];
+  uint64_t head;                /* Bytes written, by the writer ... */
+  uint32_t wseq;                /* ... which bumps this to wake the reader */
+  uint32_t rwait;               /* The reader is asleep on wseq */
+  char     pad1[48];
+  uint64_t tail;                /* Bytes read, by the reader ... */
+  uint32_t rseq;                /* ... which bumps this to wake the writer */
+  uint32_t wwait;               /* The writer is asleep on rseq */
+  char     pad2[48];
+};
+
+struct ring {
+  struct ringhdr *h;
+  char           *data;
+  uint32_t        mask;
+  size_t          maplen;
+  int             writer;       /* TRUE on the writing side */
+  long long       born;         /* ms the writer made the ring at */
+  char            path[256];    /* Its shared memory name */
+};
+
+int     ring_create(struct ring *r, const char *name);
+int     ring_attach(struct ring *r, const char *name);
+int     ring_write(struct ring *r, const char *p, size_t n);
+ssize_t ring_peek(struct ring *r, char **p);
+void    ring_consume(struct ring *r, size_t n);
+void    ring_close(struct ring *r);
+
+#endif
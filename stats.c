@@ -0,0 +1,210 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  Statistics of a run of fuzz, see stats.h
+ */
+
+#include <string.h>
+#include <time.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+#define NSEC 1000000000LL
+
+
+static int    bucket(unsigned long long len);
+static void   bytehist(struct stats *s, unsigned long long *h);
+static int    lastbucket(struct stats *s);
+static double seconds(long long ns);
+
+
+/*
+ * Nanoseconds on the monotonic clock
+ */
+long long stats_clock( void ) {
+  struct timespec t;
+
+
+  clock_gettime( CLOCK_MONOTONIC, &t );
+
+  return( (long long) t.tv_sec * NSEC + t.tv_nsec );
+}
+
+
+void stats_init( struct stats *s ) {
+  memset( s, 0, sizeof(*s) );
+  s->start = stats_clock();
+}
+
+
+/*
+ * Count the "n" bytes at "p", which are on their way out: their
+ * values, and the lengths of the lines they end
+ */
+void stats_bytes( struct stats *s, const char *p, size_t n ) {
+  const unsigned char *u = (const unsigned char *) p;
+  const char          *q, *lf, *end = p + n;
+  size_t               i;
+
+
+  s->bytes += n;
+
+  for( i = 0 ; i + 4 <= n ; i += 4 ) {
+    s->hist[0][u[i]]++;
+    s->hist[1][u[i + 1]]++;
+    s->hist[2][u[i + 2]]++;
+    s->hist[3][u[i + 3]]++;
+  }
+
+  for( ; i < n ; i++ ) {
+    s->hist[0][u[i]]++;
+  }
+
+  for( q = p ; (lf = memchr(q, '\n', end - q)) != NULL ; q = lf + 1 ) {
+    s->lhist[bucket(s->cur + (lf - q))]++;
+    s->lines++;
+    s->cur = 0;
+  }
+
+  s->cur += end - q;
+}
+
+
+/*
+ * Bucket of a line of "len" bytes, LF not counted 
+ */
+static int bucket( unsigned long long len ) {
+  return( len == 0 ? 0 : 64 - __builtin_clzll(len) );
+}
+
+
+static int lastbucket( struct stats *s ) {
+  int b;
+
+
+  for( b = STATS_LBUCKETS - 1 ; b > 0 && s->lhist[b] == 0 ; b-- ) {
+    ;
+  }
+
+  return( b );
+}
+
+
+static void bytehist( struct stats *s, unsigned long long *h ) {
+  int c;
+
+
+  for( c = 0 ; c < 256 ; c++ ) {
+    h[c] = s->hist[0][c] + s->hist[1][c] + s->hist[2][c] + s->hist[3][c];
+  }
+}
+
+
+static double seconds( long long ns ) {
+  return( ns / (double) NSEC );
+}
+
+
+/*
+ * Human readable report on "f", each line headed by "who"
+ */
+void stats_report( struct stats *s, FILE *f, char *who ) {
+  unsigned long long h[256];
+  long long          all = stats_clock() - s->start;
+  int                c, lo = -1, hi = -1, used = 0, b, last;
+
+
+  fprintf(f, "%s: %llu bytes, %llu lines, %llu cases in %.6f s, %.1f bytes/s\n",
+          who, s->bytes, s->lines, s->cases, seconds(all),
+          all > 0 ? s->bytes / seconds(all) : 0.0);
+
+  fprintf(f, "%s: %.6f s %s, %.6f s in %llu write calls, %.6f s paced in %llu sleeps\n",
+          who, seconds(all - s->outns - s->pacens), s->reading ? "reading" : "generating",
+          seconds(s->outns), s->calls, seconds(s->pacens), s->sleeps);
+
+  bytehist( s, h );
+
+  for( c = 0 ; c < 256 ; c++ ) {
+    if( h[c] == 0 ) {
+      continue;
+    }
+
+    used++;
+
+    if( lo < 0 || h[c] < h[lo] ) {
+      lo = c;
+    }
+
+    if( hi < 0 || h[c] > h[hi] ) {
+      hi = c;
+    }
+  }
+
+  if( used > 0 ) {
+    fprintf(f, "%s: %d byte values, rarest 0x%02x (%llu), commonest 0x%02x (%llu)\n",
+            who, used, lo, h[lo], hi, h[hi]);
+  }
+
+  if( s->lines == 0 ) {
+    return;
+  }
+
+  fprintf(f, "%s: line lengths:", who);
+  last = lastbucket( s );
+
+  for( b = 0 ; b <= last ; b++ ) {
+    if( b < 2 ) {
+      fprintf(f, " %d:%llu", b, s->lhist[b]);
+    }
+    else {
+      fprintf(f, " %llu-%llu:%llu", 1ULL << (b - 1), (1ULL << b) - 1, s->lhist[b]);
+    }
+  }
+
+  putc('\n', f);
+}
+
+
+/*
+ * The same as one JSON object, with the whole byte histogram
+ */
+void stats_json( struct stats *s, FILE *f ) {
+  unsigned long long h[256];
+  long long          all = stats_clock() - s->start;
+  int                c, b, last;
+
+
+  fprintf(f, "{\"bytes\": %llu, \"lines\": %llu, \"cases\": %llu, ",
+          s->bytes, s->lines, s->cases);
+  fprintf(f, "\"seconds\": %.9f, \"%s\": %.9f, \"out_seconds\": %.9f, ",
+          seconds(all), s->reading ? "read_seconds" : "gen_seconds",
+          seconds(all - s->outns - s->pacens), seconds(s->outns));
+  fprintf(f, "\"pace_seconds\": %.9f, \"write_calls\": %llu, \"pace_sleeps\": %llu, ",
+          seconds(s->pacens), s->calls, s->sleeps);
+  fprintf(f, "\"bytes_per_second\": %.1f,\n", all > 0 ? s->bytes / seconds(all) : 0.0);
+
+  bytehist( s, h );
+  fprintf(f, " \"byte_hist\": [");
+
+  for( c = 0 ; c < 256 ; c++ ) {
+    fprintf(f, "%s%llu", c == 0 ? "" : c % 16 == 0 ? ",\n  " : ", ", h[c]);
+  }
+
+  fprintf(f, "],\n \"line_hist\": [");
+  last = s->lines > 0 ? lastbucket(s) : -1;
+
+  for( b = 0 ; b <= last ; b++ ) {
+    fprintf(f, "%s{\"min\": %llu, \"max\": %llu, \"count\": %llu}",
+            b == 0 ? "" : ",\n  ", b < 2 ? (unsigned long long) b : 1ULL << (b - 1),
+            b < 2 ? (unsigned long long) b : (1ULL << b) - 1, s->lhist[b]);
+  }
+
+  fprintf(f, "]}\n");
+}
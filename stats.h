@@ -0,0 +1,49 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  Statistics of a run of fuzz
+ *
+ *  The bytes are counted where they leave the program, a buffer at
+ *  a time, so that the generators are not slowed down.  The time of
+ *  the run is split into the time spent in write calls, the time
+ *  spent waiting for the pace, and the rest, which is generation, or
+ *  reading the input when a stream is replayed from a file (-r).
+ *
+ *  The system calls counted are the writes and the pacing sleeps;
+ *  others, such as reads of the input or waits on a -q ring, are not.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define STATS_LBUCKETS 65       /* Line lengths 0, 1, 2-3, 4-7, ... */
+
+struct stats {
+  unsigned long long bytes, lines, cases;
+  unsigned long long calls;     /* Write calls */
+  long long          outns;     /* ... and the time spent in them */
+  long long          pacens;    /* Time spent waiting for the pace ... */
+  unsigned long long sleeps;    /* ... in this many sleeps */
+  int                reading;   /* The rest is reading the input, not generating */
+  long long          start;
+  unsigned long long cur;       /* Length of the line being counted */
+  unsigned long long hist[4][256]; /* Bytes, in 4 tables so that ... */
+  unsigned long long lhist[STATS_LBUCKETS]; /* ... runs of a byte do not stall */
+};
+
+long long stats_clock(void);
+void      stats_init(struct stats *s);
+void      stats_bytes(struct stats *s, const char *p, size_t n);
+void      stats_report(struct stats *s, FILE *f, char *who);
+void      stats_json(struct stats *s, FILE *f);
+
+#endif
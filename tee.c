@@ -0,0 +1,238 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  A copy of the output of fuzz to a file, see tee.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "tee.h"
+
+
+static void *writer(void *arg);
+static int   writeall(int fd, const char *p, size_t n);
+static int   submit(struct tee *t);
+
+
+/*
+ * Start copying to "fd", syncing it as "sync" says.  Returns -1 with
+ * errno set on failure.
+ */
+int tee_open( struct tee *t, int fd, long long sync ) {
+  int i;
+
+
+  memset( t, 0, sizeof(*t) );
+  t->fd   = fd;
+  t->sync = sync;
+
+  for( i = 0 ; i < TEE_NBUF ; i++ ) {
+    if( (t->buf[i] = malloc(TEE_BUFSIZ)) == NULL ) {
+      return( -1 );
+    }
+  }
+
+  pthread_mutex_init( &t->lock, NULL );
+  pthread_cond_init( &t->cond, NULL );
+
+  if( (errno = pthread_create(&t->tid, NULL, writer, t)) != 0 ) {
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Copy the "n" bytes at "p".  Returns -1 with errno set if writing
+ * the file has failed since the last call.
+ */
+int tee_write( struct tee *t, const char *p, size_t n ) {
+  size_t k;
+
+
+  while( n > 0 ) {
+    k = TEE_BUFSIZ - t->len[t->fill];
+    k = n < k ? n : k;
+
+    memcpy( t->buf[t->fill] + t->len[t->fill], p, k );
+    t->len[t->fill] += k;
+    p += k;
+    n -= k;
+
+    if( t->len[t->fill] == TEE_BUFSIZ && submit(t) < 0 ) {
+      return( -1 );
+    }
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Write out what is left, sync if asked to and close the file.  Can
+ * be called again; it then does nothing.
+ */
+int tee_close( struct tee *t ) {
+  int i, err;
+
+
+  if( t->fd < 0 ) {
+    return( 0 );
+  }
+
+  pthread_mutex_lock( &t->lock );
+
+  if( t->len[t->fill] > 0 ) {
+    t->queued++;
+  }
+
+  t->done = 1;
+  pthread_cond_broadcast( &t->cond );
+  pthread_mutex_unlock( &t->lock );
+  pthread_join( t->tid, NULL );
+
+  err = t->err;
+
+  /* Syncing a pipe or a tty is not an error */
+  if( err == 0 && t->sync != TEE_SYNC_NONE && fdatasync(t->fd) < 0 &&
+      errno != EINVAL && errno != EROFS ) {
+    err = errno;
+  }
+
+  if( close(t->fd) < 0 && err == 0 ) {
+    err = errno;
+  }
+
+  t->fd = -1;
+
+  for( i = 0 ; i < TEE_NBUF ; i++ ) {
+    free( t->buf[i] );
+  }
+
+  pthread_mutex_destroy( &t->lock );
+  pthread_cond_destroy( &t->cond );
+
+  if( err != 0 ) {
+    errno = err;
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * Hand the block being filled to the writer and go on with the next
+ * one, once the writer is done with it
+ */
+static int submit( struct tee *t ) {
+  int err;
+
+
+  pthread_mutex_lock( &t->lock );
+  t->queued++;
+  pthread_cond_broadcast( &t->cond );
+  t->fill = (t->fill + 1) % TEE_NBUF;
+
+  while( t->queued == TEE_NBUF ) {
+    pthread_cond_wait( &t->cond, &t->lock );
+  }
+
+  err = t->err;
+  pthread_mutex_unlock( &t->lock );
+
+  if( err != 0 ) {
+    errno = err;
+    return( -1 );
+  }
+
+  return( 0 );
+}
+
+
+/*
+ * The writer thread: write the full blocks in order.  After an error
+ * the blocks are still taken, but dropped, so that the sender never
+ * waits for ever.
+ */
+static void *writer( void *arg ) {
+  struct tee *t = (struct tee *) arg;
+  int         i, err;
+
+
+  for( ;; ) {
+    pthread_mutex_lock( &t->lock );
+
+    while( t->queued == 0 && !t->done ) {
+      pthread_cond_wait( &t->cond, &t->lock );
+    }
+
+    if( t->queued == 0 ) {
+      pthread_mutex_unlock( &t->lock );
+      return( NULL );
+    }
+
+    i   = t->next;
+    err = t->err;
+    pthread_mutex_unlock( &t->lock );
+
+    if( err == 0 && writeall(t->fd, t->buf[i], t->len[i]) < 0 ) {
+      err = errno;
+    }
+
+    if( err == 0 && t->sync > 0 ) {
+      t->unsynced += t->len[i];
+
+      if( t->unsynced >= t->sync ) {
+        if( fdatasync(t->fd) < 0 && errno != EINVAL && errno != EROFS ) {
+          err = errno;
+        }
+
+        t->unsynced = 0;
+      }
+    }
+
+    pthread_mutex_lock( &t->lock );
+    t->err    = err;
+    t->len[i] = 0;
+    t->next   = (i + 1) % TEE_NBUF;
+    t->queued--;
+    pthread_cond_broadcast( &t->cond );
+    pthread_mutex_unlock( &t->lock );
+  }
+}
+
+
+/*
+ * write() all "n" bytes at "p", restarting after short writes and
+ * signals
+ */
+static int writeall( int fd, const char *p, size_t n ) {
+  ssize_t k;
+
+
+  while( n > 0 ) {
+    if( (k = write(fd, p, n)) < 0 ) {
+      if( errno == EINTR ) {
+        continue;
+      }
+
+      return( -1 );
+    }
+
+    p += k;
+    n -= k;
+  }
+
+  return( 0 );
+}
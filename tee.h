@@ -0,0 +1,51 @@
+/*
+ *  Copyright (c) 1989 Lars Fredriksen, Bryan So, Barton Miller
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+/*
+ *  A copy of the output of fuzz to a file, written in the background
+ *
+ *  Bytes are collected in one of TEE_NBUF blocks; a full block is
+ *  handed to a writer thread and the next one is filled meanwhile, so
+ *  the sender only waits for the file when all blocks are full, and
+ *  memory stays bounded by TEE_NBUF * TEE_BUFSIZ.  The first error of
+ *  the writer is kept and returned by the next call.
+ */
+
+#ifndef TEE_H
+#define TEE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define TEE_NBUF   2
+#define TEE_BUFSIZ (1 << 20)
+
+#define TEE_SYNC_NONE 0         /* Never sync the file */
+#define TEE_SYNC_END  (-1)      /* Sync it when closed, else every that ... */
+
+struct tee {
+  int             fd;           /* -1 once closed */
+  long long       sync;         /* ... many bytes, and when closed */
+  long long       unsynced;
+  char           *buf[TEE_NBUF];
+  size_t          len[TEE_NBUF];
+  int             fill;         /* Block being filled */
+  int             next;         /* Block the writer takes next ... */
+  int             queued;       /* ... of this many full ones */
+  int             done;         /* No more blocks will come */
+  int             err;          /* errno of the first failure, or 0 */
+  pthread_t       tid;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+};
+
+int tee_open(struct tee *t, int fd, long long sync);
+int tee_write(struct tee *t, const char *p, size_t n);
+int tee_close(struct tee *t);
+
+#endif